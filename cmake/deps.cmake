@@ -2,7 +2,8 @@
 
 
 # deps libs (for exec)
-set(PROJ_DEPS_LIBS )
+find_package(Threads REQUIRED)
+set(PROJ_DEPS_LIBS ${CMAKE_THREAD_LIBS_INIT})
 
 # include dirs
 set(PROJ_INCLUDE_DIRS )
@@ -0,0 +1,232 @@
+//
+// file : background_snapshot.hpp
+// in : file:///home/tim/projects/persistence/persistence/background_snapshot.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_3125071960473313521_1083741790__BACKGROUND_SNAPSHOT_HPP__
+# define __N_3125071960473313521_1083741790__BACKGROUND_SNAPSHOT_HPP__
+
+#include <cstdio>
+#include <string>
+#include "object.hpp"
+#include "parallel.hpp"
+#include "file_writer.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+# define N_PERSISTENCE_USE_FORK
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <cerrno>
+#else
+# include <fstream>
+#endif
+
+namespace neam
+{
+  namespace cr
+  {
+    /// \brief the result of persistence::background_snapshot(): the (child) process that writes the snapshot
+    /// \code
+    /// snapshot_process snapshot = neam::cr::persistence::background_snapshot<neam::cr::persistence_backend::neam>(state, "state.snapshot");
+    /// // ... the state can be modified here ...
+    /// if (!snapshot.wait())
+    ///   std::cerr << "the snapshot has failed" << std::endl;
+    /// \endcode
+    /// \note the destructor waits for the process (a snapshot is never left behind)
+    class snapshot_process
+    {
+      public:
+        snapshot_process() = default;
+        snapshot_process(const snapshot_process &) = delete;
+        snapshot_process &operator = (const snapshot_process &) = delete;
+        snapshot_process(snapshot_process &&o) : pid(o.pid), done(o.done), result(o.result)
+        {
+          o.pid = -1;
+          o.done = true;
+        }
+        snapshot_process &operator = (snapshot_process &&o)
+        {
+          if (&o == this)
+            return *this;
+          wait();
+          pid = o.pid;
+          done = o.done;
+          result = o.result;
+          o.pid = -1;
+          o.done = true;
+          return *this;
+        }
+        ~snapshot_process()
+        {
+          wait();
+        }
+
+        /// \brief return \b true once the snapshot is written (or has failed)
+        bool is_done()
+        {
+#ifdef N_PERSISTENCE_USE_FORK
+          if (!done)
+          {
+            int status = 0;
+            const pid_t res = waitpid(pid, &status, WNOHANG);
+            if (res == pid)
+              _set_status(status);
+            else if (res < 0)
+              _set_status(-1);
+          }
+#endif
+          return done;
+        }
+
+        /// \brief wait for the snapshot to be written
+        /// \return \b true if the file has been written
+        bool wait()
+        {
+#ifdef N_PERSISTENCE_USE_FORK
+          while (!done)
+          {
+            int status = 0;
+            const pid_t res = waitpid(pid, &status, 0);
+            if (res == pid)
+              _set_status(status);
+            else if (res < 0 && errno != EINTR)
+              _set_status(-1);
+          }
+#endif
+          return result;
+        }
+
+      private:
+        snapshot_process(bool _done, bool _result) : done(_done), result(_result) {}
+
+#ifdef N_PERSISTENCE_USE_FORK
+        explicit snapshot_process(pid_t _pid) : pid(_pid), done(false), result(false) {}
+
+        void _set_status(int status)
+        {
+          done = true;
+          result = (status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        }
+
+        /// \brief write the snapshot to a temporary file that then replaces \e path
+        static bool _write_file(const std::string &path, const raw_data &data)
+        {
+          if (!data.data)
+            return false;
+          const std::string tmp_path = path + ".snapshot-tmp";
+          const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+          if (fd < 0)
+            return false;
+
+          const char *memory = reinterpret_cast<const char *>(data.data);
+          size_t remaining = data.size;
+          while (remaining)
+          {
+            const ssize_t written = ::write(fd, memory, remaining);
+            if (written < 0 && errno == EINTR)
+              continue;
+            if (written <= 0)
+            {
+              ::close(fd);
+              ::unlink(tmp_path.c_str());
+              return false;
+            }
+            memory += written;
+            remaining -= written;
+          }
+          if (::fsync(fd) != 0 || ::close(fd) != 0 || ::rename(tmp_path.c_str(), path.c_str()) != 0)
+          {
+            ::unlink(tmp_path.c_str());
+            return false;
+          }
+          return internal::file_writer::sync_directory(path); // (the rename itself)
+        }
+
+        pid_t pid = -1;
+#else
+        static bool _write_file(const std::string &path, const raw_data &data)
+        {
+          if (!data.data)
+            return false;
+          std::ofstream file(path, std::ios_base::binary | std::ios_base::trunc);
+          file.write(reinterpret_cast<const char *>(data.data), data.size);
+          file.close();
+          return !file.fail();
+        }
+#endif
+
+        bool done = true;
+        bool result = false;
+
+        friend struct persistence;
+    };
+
+    template<typename Backend, typename Type, typename... Params>
+    snapshot_process persistence::background_snapshot(const Type &obj, const std::string &path, Params... p)
+    {
+#ifdef N_PERSISTENCE_USE_FORK
+      // a thread of the library may hold a lock the child would wait for forever
+      // (the guard prevents any of them from starting to work until the fork is done)
+      internal::thread_activity::fork_guard guard;
+      if (guard.is_busy())
+        return snapshot_process(true, false);
+
+      // (buffered output would be flushed twice: once by each process)
+      fflush(nullptr);
+      std::cout.flush();
+      std::cerr.flush();
+
+      const pid_t pid = fork();
+      // (the child has a copy of the guard, held by its only thread)
+      guard.release();
+      if (pid < 0)
+        return snapshot_process(true, false);
+      if (pid > 0)
+        return snapshot_process(pid);
+
+      // the child: it only writes the snapshot (no destructor, no atexit handler, no stdio flush)
+      // (an exception must not unwind the copy of the caller's stack)
+      try
+      {
+        internal::thread_activity::in_forked_process() = true;
+        const bool res = snapshot_process::_write_file(path, serialize<Backend>(obj, std::forward<Params>(p)...));
+        _exit(res ? 0 : 1);
+      }
+      catch (...)
+      {
+        _exit(1);
+      }
+#else
+      const bool res = snapshot_process::_write_file(path, serialize<Backend>(obj, std::forward<Params>(p)...));
+      return snapshot_process(true, res);
+#endif
+    }
+  } // namespace r
+} // namespace neam
+
+#endif /*__N_3125071960473313521_1083741790__BACKGROUND_SNAPSHOT_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
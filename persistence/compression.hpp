@@ -0,0 +1,417 @@
+//
+// file : compression.hpp
+// in : file:///home/tim/projects/persistence/persistence/compression.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_2861739302217153641_1507921466__COMPRESSION_HPP__
+# define __N_2861739302217153641_1507921466__COMPRESSION_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <memory>
+
+#include "tools/memory_allocator.hpp"
+
+/// \file compression.hpp
+/// \brief a small, self-contained LZ77 codec (LZ4-like sequences) used by the \e compressed wrapper and the storage
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      namespace lz
+      {
+        /// \brief the frame header, written in front of the compressed blocks
+        struct frame_header
+        {
+          uint32_t magic;
+          uint32_t block_size;
+          uint64_t raw_size;
+        };
+
+        constexpr uint32_t frame_magic = 0x5A4C434E; // "NCLZ"
+
+        /// \brief each block is compressed independently, so a block never references data outside itself
+        constexpr size_t block_size = 64 * 1024;
+
+        /// \brief the high bit of a block header tells the block is stored as-is
+        constexpr uint32_t stored_block_flag = 0x80000000;
+
+        constexpr size_t min_match = 4;
+        constexpr size_t max_offset = 0xFFFF;
+        constexpr size_t hash_log = 14;
+
+        /// \brief the maximum size a block of \e size bytes can take once compressed (header included)
+        static inline size_t block_bound(size_t size)
+        {
+          return sizeof(uint32_t) + size;
+        }
+
+        /// \brief the maximum size a frame can take
+        static inline size_t frame_bound(size_t size)
+        {
+          return sizeof(frame_header) + size + ((size + block_size - 1) / block_size) * sizeof(uint32_t);
+        }
+
+        static inline uint32_t read32(const uint8_t *p)
+        {
+          uint32_t v;
+          memcpy(&v, p, sizeof(v));
+          return v;
+        }
+
+        static inline uint32_t hash(uint32_t v)
+        {
+          return (v * 2654435761u) >> (32 - hash_log);
+        }
+
+        /// \brief Match finder state. Allocated once per frame and re-used for every block.
+        struct match_finder
+        {
+          uint32_t head[1 << hash_log];
+          uint32_t chain[block_size];
+
+          void reset()
+          {
+            memset(head, 0, sizeof(head));
+          }
+        };
+
+        static inline bool write_length(uint8_t *&op, const uint8_t *oend, size_t length)
+        {
+          for (; length >= 255; length -= 255)
+          {
+            if (op >= oend)
+              return false;
+            *op++ = 255;
+          }
+          if (op >= oend)
+            return false;
+          *op++ = static_cast<uint8_t>(length);
+          return true;
+        }
+
+        static inline bool write_sequence(uint8_t *&op, const uint8_t *oend, const uint8_t *literals, size_t literal_length, size_t offset, size_t match_length)
+        {
+          if (op >= oend)
+            return false;
+          uint8_t *token = op++;
+          *token = static_cast<uint8_t>((literal_length >= 15 ? 15 : literal_length) << 4);
+          if (literal_length >= 15 && !write_length(op, oend, literal_length - 15))
+            return false;
+          if (size_t(oend - op) < literal_length)
+            return false;
+          memcpy(op, literals, literal_length);
+          op += literal_length;
+
+          if (!match_length) // last sequence: literals only
+            return true;
+
+          if (size_t(oend - op) < 2)
+            return false;
+          *op++ = static_cast<uint8_t>(offset & 0xFF);
+          *op++ = static_cast<uint8_t>(offset >> 8);
+          match_length -= min_match;
+          *token |= static_cast<uint8_t>(match_length >= 15 ? 15 : match_length);
+          if (match_length >= 15 && !write_length(op, oend, match_length - 15))
+            return false;
+          return true;
+        }
+
+        /// \brief compress a single block (at most block_size bytes)
+        /// \param level 1 is the fastest, higher levels search longer hash chains
+        /// \return the compressed size, or 0 if the compressed block would not be smaller than \e capacity
+        static inline size_t compress_block(match_finder &mf, const uint8_t *src, size_t size, uint8_t *dst, size_t capacity, unsigned level)
+        {
+          const size_t max_depth = (level <= 1 ? 1 : (level >= 9 ? 256 : (size_t(1) << (level - 1))));
+          const uint8_t *const oend = dst + capacity;
+          uint8_t *op = dst;
+
+          mf.reset();
+
+          size_t ip = 0;
+          size_t anchor = 0;
+          size_t misses = 0;
+          while (ip + min_match <= size)
+          {
+            const uint32_t sequence = read32(src + ip);
+            const uint32_t h = hash(sequence);
+
+            size_t best_length = 0;
+            size_t best_pos = 0;
+            uint32_t candidate = mf.head[h];
+            for (size_t depth = 0; candidate && depth < max_depth; ++depth)
+            {
+              const size_t pos = candidate - 1;
+              if (ip - pos > max_offset)
+                break;
+              if (read32(src + pos) == sequence)
+              {
+                size_t length = min_match;
+                while (ip + length < size && src[pos + length] == src[ip + length])
+                  ++length;
+                if (length > best_length)
+                {
+                  best_length = length;
+                  best_pos = pos;
+                }
+              }
+              candidate = mf.chain[pos];
+            }
+            mf.chain[ip] = mf.head[h];
+            mf.head[h] = uint32_t(ip + 1);
+
+            if (!best_length)
+            {
+              // skip faster through incompressible data (less so at higher levels)
+              ip += 1 + (misses++ >> (level <= 1 ? 5 : 8));
+              continue;
+            }
+            misses = 0;
+
+            if (!write_sequence(op, oend, src + anchor, ip - anchor, ip - best_pos, best_length))
+              return 0;
+
+            // register the positions covered by the match, so later matches can reference them
+            const size_t match_end = ip + best_length;
+            if (level > 1)
+            {
+              for (++ip; ip < match_end && ip + min_match <= size; ++ip)
+              {
+                const uint32_t hh = hash(read32(src + ip));
+                mf.chain[ip] = mf.head[hh];
+                mf.head[hh] = uint32_t(ip + 1);
+              }
+            }
+            ip = match_end;
+            anchor = ip;
+          }
+
+          if (!write_sequence(op, oend, src + anchor, size - anchor, 0, 0))
+            return 0;
+          if (op >= oend)
+            return 0; // not worth it
+          return op - dst;
+        }
+
+        /// \brief decompress a single block. The output must fill exactly \e raw_size bytes
+        static inline bool decompress_block(const uint8_t *src, size_t size, uint8_t *dst, size_t raw_size)
+        {
+          const uint8_t *ip = src;
+          const uint8_t *const iend = src + size;
+          uint8_t *op = dst;
+          uint8_t *const oend = dst + raw_size;
+
+          while (ip < iend)
+          {
+            const uint8_t token = *ip++;
+
+            // literals
+            size_t length = token >> 4;
+            if (length == 15)
+            {
+              uint8_t b;
+              do
+              {
+                if (ip >= iend)
+                  return false;
+                b = *ip++;
+                length += b;
+              }
+              while (b == 255);
+            }
+            if (size_t(iend - ip) < length || size_t(oend - op) < length)
+              return false;
+            memcpy(op, ip, length);
+            ip += length;
+            op += length;
+
+            if (ip == iend) // last sequence
+              break;
+
+            // match
+            if (iend - ip < 2)
+              return false;
+            const size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+            ip += 2;
+            if (!offset || offset > size_t(op - dst))
+              return false;
+            length = (token & 0x0F);
+            if (length == 15)
+            {
+              uint8_t b;
+              do
+              {
+                if (ip >= iend)
+                  return false;
+                b = *ip++;
+                length += b;
+              }
+              while (b == 255);
+            }
+            length += min_match;
+            if (size_t(oend - op) < length)
+              return false;
+            const uint8_t *match = op - offset;
+            if (offset >= length)
+            {
+              memcpy(op, match, length);
+              op += length;
+            }
+            else // overlapping copy (repetitions)
+            {
+              for (size_t i = 0; i < length; ++i)
+                *op++ = *match++;
+            }
+          }
+          return op == oend;
+        }
+
+        /// \brief compress a single block and append it (with its header) to \e dst
+        /// \return the number of bytes written in \e dst (at most block_bound(size))
+        /// \note \e mf can only be null when \e level is 0
+        static inline size_t write_block(match_finder *mf, const uint8_t *src, size_t size, uint8_t *dst, unsigned level)
+        {
+          size_t csize = 0;
+          if (level > 0 && mf)
+            csize = compress_block(*mf, src, size, dst + sizeof(uint32_t), size, level);
+
+          uint32_t header;
+          if (!csize)
+          {
+            header = uint32_t(size) | stored_block_flag;
+            memcpy(dst + sizeof(uint32_t), src, size);
+            csize = size;
+          }
+          else
+            header = uint32_t(csize);
+          memcpy(dst, &header, sizeof(header));
+          return sizeof(uint32_t) + csize;
+        }
+
+        /// \brief read a block written by write_block
+        /// \param[in,out] offset the offset of the block header in \e src, updated to the next block
+        static inline bool read_block(const uint8_t *src, size_t size, size_t &offset, uint8_t *dst, size_t raw_size)
+        {
+          if (offset + sizeof(uint32_t) > size)
+            return false;
+          uint32_t header;
+          memcpy(&header, src + offset, sizeof(header));
+          offset += sizeof(uint32_t);
+
+          const size_t csize = header & ~stored_block_flag;
+          if (offset + csize > size)
+            return false;
+
+          bool res;
+          if (header & stored_block_flag)
+          {
+            res = (csize == raw_size);
+            if (res)
+              memcpy(dst, src + offset, raw_size);
+          }
+          else
+            res = decompress_block(src + offset, csize, dst, raw_size);
+          offset += csize;
+          return res;
+        }
+
+        /// \brief compress \e src into a frame appended to \e mem
+        /// \param[out] size the size of the frame
+        /// \note blocks are compressed in a small buffer then appended, so no full-size temporary is needed
+        static inline bool compress(memory_allocator &mem, size_t &size, const char *src, size_t src_size, unsigned level)
+        {
+          frame_header *header = reinterpret_cast<frame_header *>(mem.allocate(sizeof(frame_header)));
+          if (!header)
+            return false;
+          header->magic = frame_magic;
+          header->block_size = block_size;
+          header->raw_size = src_size;
+          size = sizeof(frame_header);
+
+          std::unique_ptr<match_finder> mf(level > 0 ? new(std::nothrow) match_finder : nullptr);
+          if (level > 0 && !mf)
+            return false;
+          std::unique_ptr<uint8_t[]> block(new(std::nothrow) uint8_t[block_bound(block_size)]);
+          if (!block)
+            return false;
+
+          for (size_t offset = 0; offset < src_size; offset += block_size)
+          {
+            const size_t raw_size = (src_size - offset < block_size ? src_size - offset : block_size);
+            const size_t csize = write_block(mf.get(), reinterpret_cast<const uint8_t *>(src) + offset, raw_size, block.get(), level);
+
+            void *dst = mem.allocate(csize);
+            if (!dst)
+              return false;
+            memcpy(dst, block.get(), csize);
+            size += csize;
+          }
+          return true;
+        }
+
+        /// \brief return the size of the data once decompressed
+        static inline bool get_raw_size(const char *src, size_t size, size_t &raw_size)
+        {
+          if (size < sizeof(frame_header))
+            return false;
+          frame_header header;
+          memcpy(&header, src, sizeof(header));
+          if (header.magic != frame_magic || header.block_size == 0 || header.block_size > block_size)
+            return false;
+          raw_size = header.raw_size;
+          return true;
+        }
+
+        /// \brief decompress a frame. \e dst must be get_raw_size() bytes long.
+        /// \note bytes after the last block are ignored
+        static inline bool decompress(const char *src, size_t size, char *dst, size_t raw_size)
+        {
+          size_t expected_raw_size;
+          if (!get_raw_size(src, size, expected_raw_size) || expected_raw_size != raw_size)
+            return false;
+          frame_header header;
+          memcpy(&header, src, sizeof(header));
+
+          size_t offset = sizeof(frame_header);
+          for (size_t raw_offset = 0; raw_offset < raw_size; raw_offset += header.block_size)
+          {
+            const size_t block_raw_size = (raw_size - raw_offset < header.block_size ? raw_size - raw_offset : header.block_size);
+            if (!read_block(reinterpret_cast<const uint8_t *>(src), size, offset, reinterpret_cast<uint8_t *>(dst) + raw_offset, block_raw_size))
+              return false;
+          }
+          return true;
+        }
+      } // namespace lz
+    } // namespace internal
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_2861739302217153641_1507921466__COMPRESSION_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
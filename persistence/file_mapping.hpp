@@ -0,0 +1,169 @@
+//
+// file : file_mapping.hpp
+// in : file:///home/tim/projects/persistence/persistence/file_mapping.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_1990617438296450714_883510246__FILE_MAPPING_HPP__
+# define __N_1990617438296450714_883510246__FILE_MAPPING_HPP__
+
+#include <cstddef>
+#include <string>
+#include <fstream>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+# define N_PERSISTENCE_USE_MMAP
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      /// \brief a read-only view of a whole file
+      /// With mmap (on unix systems) only the pages that are actually read are loaded, and they are shared through the page cache.
+      /// Elsewhere, the file is read in memory.
+      /// \attention the file must not be truncated while it is mapped
+      class file_mapping
+      {
+        public:
+          file_mapping() = default;
+          file_mapping(const file_mapping &) = delete;
+          file_mapping &operator = (const file_mapping &) = delete;
+          ~file_mapping()
+          {
+            close();
+          }
+
+#ifdef N_PERSISTENCE_USE_MMAP
+          /// \brief true if what is appended to the file once it is mapped can be read through the mapping (see open())
+          static constexpr bool sees_appends = true;
+#else
+          static constexpr bool sees_appends = false;
+#endif
+
+          /// \brief map a file (any previous mapping is closed). Return false if the file can't be read or is empty.
+          /// \param reserve with mmap, the file is mapped on (at least) that many bytes: what is appended to the file
+          ///                (up to that size) can then be read through the mapping (see covers()). Elsewhere, it is ignored.
+          bool open(const std::string &filename, size_t reserve = 0)
+          {
+            close();
+#ifdef N_PERSISTENCE_USE_MMAP
+            const int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0)
+              return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size <= 0)
+            {
+              ::close(fd);
+              return false;
+            }
+            // (the pages after the end of the file can be mapped, they just can't be read until the file covers them)
+            const size_t length = (reserve > size_t(st.st_size) ? reserve : size_t(st.st_size));
+            void *ptr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd); // the mapping stays valid
+            if (ptr == MAP_FAILED)
+              return false;
+            memory = reinterpret_cast<const char *>(ptr);
+            size = st.st_size;
+            capacity = length;
+            return true;
+#else
+            std::ifstream file(filename, std::ios_base::binary | std::ios_base::ate);
+            if (!file)
+              return false;
+            const size_t file_size = file.tellg();
+            if (!file_size)
+              return false;
+            char *buffer = new(std::nothrow) char[file_size];
+            if (!buffer)
+              return false;
+            file.seekg(0, std::ios_base::beg);
+            if (!file.read(buffer, file_size))
+            {
+              delete [] buffer;
+              return false;
+            }
+            memory = buffer;
+            size = file_size;
+            capacity = file_size;
+            return true;
+#endif
+          }
+
+          /// \brief unmap the file
+          void close()
+          {
+            if (!memory)
+              return;
+#ifdef N_PERSISTENCE_USE_MMAP
+            munmap(const_cast<char *>(memory), capacity);
+#else
+            delete [] memory;
+#endif
+            memory = nullptr;
+            size = 0;
+            capacity = 0;
+          }
+
+          bool is_open() const
+          {
+            return memory != nullptr;
+          }
+
+          const char *data() const
+          {
+            return memory;
+          }
+
+          /// \brief return the size of the file when it has been mapped
+          size_t get_size() const
+          {
+            return size;
+          }
+
+          /// \brief return true if the first \e end bytes of the file can be read through the mapping
+          /// (once they are in the file: they may have been appended after the file has been mapped)
+          bool covers(size_t end) const
+          {
+            return memory && end <= capacity;
+          }
+
+        private:
+          const char *memory = nullptr;
+          size_t size = 0;
+          size_t capacity = 0; ///< the size of the mapping
+      };
+    } // namespace internal
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_1990617438296450714_883510246__FILE_MAPPING_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
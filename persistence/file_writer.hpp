@@ -0,0 +1,166 @@
+//
+// file : file_writer.hpp
+// in : file:///home/tim/projects/persistence/persistence/file_writer.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_7433269287418931774_1067097882__FILE_WRITER_HPP__
+# define __N_7433269287418931774_1067097882__FILE_WRITER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+# define N_PERSISTENCE_USE_FSYNC
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <cerrno>
+#endif
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      /// \brief a file that is written at given offsets, and whose content can be synced to the disk
+      /// On unix systems, sync() is a real fsync() of the file. Elsewhere, it only flushes the buffers of the process.
+      class file_writer
+      {
+        public:
+          file_writer() = default;
+          file_writer(const file_writer &) = delete;
+          file_writer &operator = (const file_writer &) = delete;
+          ~file_writer()
+          {
+            close();
+          }
+
+          /// \brief open an existing file (any previously opened file is closed)
+          /// \param create create the file if it doesn't exist, truncate it otherwise
+          bool open(const std::string &filename, bool create = false)
+          {
+            close();
+#ifdef N_PERSISTENCE_USE_FSYNC
+            fd = ::open(filename.c_str(), O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0644);
+            return fd >= 0;
+#else
+            if (create)
+              std::ofstream(filename, std::ios_base::binary | std::ios_base::trunc);
+            file.open(filename, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+            return file.is_open();
+#endif
+          }
+
+          void close()
+          {
+#ifdef N_PERSISTENCE_USE_FSYNC
+            if (fd >= 0)
+              ::close(fd);
+            fd = -1;
+#else
+            file.close();
+#endif
+          }
+
+          bool is_open() const
+          {
+#ifdef N_PERSISTENCE_USE_FSYNC
+            return fd >= 0;
+#else
+            return file.is_open();
+#endif
+          }
+
+          /// \brief write \e size bytes at \e offset (the file grows if needed)
+          /// \return false if the data hasn't been completely written
+          bool write(uint64_t offset, const char *data, size_t size)
+          {
+#ifdef N_PERSISTENCE_USE_FSYNC
+            while (size)
+            {
+              const ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+              if (written < 0 && errno == EINTR)
+                continue;
+              if (written <= 0)
+                return false;
+              data += written;
+              offset += written;
+              size -= written;
+            }
+            return true;
+#else
+            file.clear();
+            file.seekp(offset);
+            file.write(data, size);
+            return file.good();
+#endif
+          }
+
+          /// \brief wait for everything that has been written to be on the disk
+          /// \return false if the data may not be on the disk
+          bool sync()
+          {
+#ifdef N_PERSISTENCE_USE_FSYNC
+            return fd >= 0 && ::fsync(fd) == 0;
+#else
+            file.flush();
+            return file.good();
+#endif
+          }
+
+          /// \brief make the creation (or the renaming) of \e filename durable, by syncing the directory it is in
+          static bool sync_directory(const std::string &filename)
+          {
+#ifdef N_PERSISTENCE_USE_FSYNC
+            const size_t slash = filename.find_last_of('/');
+            const std::string directory = (slash == std::string::npos ? std::string(".") : filename.substr(0, slash + 1));
+            const int dir_fd = ::open(directory.c_str(), O_RDONLY);
+            if (dir_fd < 0)
+              return false;
+            const bool res = (::fsync(dir_fd) == 0);
+            ::close(dir_fd);
+            return res;
+#else
+            (void)filename;
+            return true;
+#endif
+          }
+
+        private:
+#ifdef N_PERSISTENCE_USE_FSYNC
+          int fd = -1;
+#else
+          std::fstream file;
+#endif
+      };
+    } // namespace internal
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_7433269287418931774_1067097882__FILE_WRITER_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
@@ -0,0 +1,205 @@
+//
+// file : json_lines.hpp
+// in : file:///home/tim/projects/persistence/persistence/json_backend/json_lines.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_1942276903518232417_2027467365__JSON_LINES_HPP__
+# define __N_1942276903518232417_2027467365__JSON_LINES_HPP__
+
+#include <cstddef>
+#include <cstring>
+#include <cctype>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+
+#include "../object.hpp" // for my IDE
+#include "../parallel.hpp"
+#include "serializable_specs_json.hpp"
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      namespace json
+      {
+        /// \brief the minimum size of the parts of a JSON lines document that are parsed by a single thread
+        constexpr size_t json_lines_min_part_size = 256 * 1024;
+      } // namespace json
+    } // namespace internal
+
+    /// \brief read and write JSON lines (NDJSON): one compact JSON value per line
+    /// \code
+    /// raw_data logs = json_lines::serialize(records);
+    /// std::vector<record> back;
+    /// if (!json_lines::deserialize(logs, back))
+    ///   return false;
+    /// \endcode
+    struct json_lines
+    {
+      /// \brief serialize [begin, end[ (one element per line, each line ends with a '\n')
+      /// \return an empty \e raw_data instance (data = nullptr and size = 0) when the process has failed
+      /// \note the returned data is followed by a '\0' (not counted in its size)
+      template<typename Iterator>
+      static raw_data serialize(Iterator begin, Iterator end)
+      {
+        using element_t = typename std::decay<decltype(*begin)>::type;
+
+        raw_data rdt;
+        neam::cr::memory_allocator mem;
+        for (; begin != end; ++begin)
+        {
+          size_t size = 0;
+          if (!persistence::serializable<persistence_backend::json_compact, element_t>::to_memory(mem, size, &*begin))
+            return rdt;
+          char *nl = reinterpret_cast<char *>(mem.allocate(1));
+          if (!nl)
+            return rdt;
+          *nl = '\n';
+        }
+        char *terminator = reinterpret_cast<char *>(mem.allocate(1));
+        if (!terminator || mem.has_failed())
+          return rdt;
+        *terminator = 0;
+
+        const size_t size = mem.size() - 1;
+        return std::move(rdt.set(size, reinterpret_cast<int8_t *>(mem.give_up_data()), neam::assume_ownership));
+      }
+
+      /// \brief serialize all the elements of \e container (one per line)
+      template<typename Container>
+      static raw_data serialize(const Container &container)
+      {
+        return serialize(std::begin(container), std::end(container));
+      }
+
+      /// \brief deserialize every line of \e data and append the elements to \e output (in the order of the lines)
+      /// Empty (or blank) lines are skipped. Big documents are split at line boundaries and parsed in parallel,
+      /// each part with its own allocation transaction.
+      /// \return false if a line can't be deserialized (\e output is then left untouched)
+      template<typename Element>
+      static bool deserialize(const char *data, size_t size, std::vector<Element> &output)
+      {
+        if (!size)
+          return true;
+
+        // split the document in parts that end at a line boundary
+        size_t thread_count = std::thread::hardware_concurrency();
+        if (!thread_count)
+          thread_count = 1;
+        size_t part_count = size / internal::json::json_lines_min_part_size + 1;
+        if (part_count > thread_count * 8)
+          part_count = thread_count * 8;
+
+        std::vector<size_t> part_starts;
+        part_starts.reserve(part_count + 1);
+        part_starts.push_back(0);
+        for (size_t i = 1; i < part_count; ++i)
+        {
+          const size_t from = std::max(i * (size / part_count), part_starts.back());
+          const char *nl = (from < size ? reinterpret_cast<const char *>(memchr(data + from, '\n', size - from)) : nullptr);
+          if (!nl)
+            break;
+          part_starts.push_back(nl + 1 - data);
+        }
+        part_starts.push_back(size);
+
+        std::vector<std::vector<Element>> parts(part_starts.size() - 1);
+        std::atomic<bool> failed(false);
+        internal::parallel_for(parts.size(), size, [&](size_t i)
+        {
+          if (!failed && !_deserialize_part(data + part_starts[i], part_starts[i + 1] - part_starts[i], parts[i]))
+            failed = true;
+        });
+        if (failed)
+          return false;
+
+        size_t total_count = output.size();
+        for (const auto &it : parts)
+          total_count += it.size();
+        output.reserve(total_count);
+        for (auto &part : parts)
+        {
+          for (auto &it : part)
+            output.push_back(std::move(it));
+        }
+        return true;
+      }
+
+      /// \brief deserialize every line of \e data and append the elements to \e output (in the order of the lines)
+      template<typename Element>
+      static bool deserialize(const raw_data &data, std::vector<Element> &output)
+      {
+        return deserialize(reinterpret_cast<const char *>(data.data), data.size, output);
+      }
+
+      private:
+        /// \brief deserialize the lines of a part of the document
+        template<typename Element>
+        static bool _deserialize_part(const char *data, size_t size, std::vector<Element> &output)
+        {
+          cr::allocation_transaction transaction;
+          typename std::aligned_storage<sizeof(Element), alignof(Element)>::type element_memory;
+          Element *element = reinterpret_cast<Element *>(&element_memory);
+
+          size_t index = 0;
+          while (index < size)
+          {
+            const char *nl = reinterpret_cast<const char *>(memchr(data + index, '\n', size - index));
+            size_t line_end = (nl ? nl - data : size);
+            const size_t next_index = line_end + 1;
+
+            // trim the line (this also removes the '\r' of "\r\n" line endings, and a final '\0')
+            while (index < line_end && std::isspace(static_cast<unsigned char>(data[index])))
+              ++index;
+            while (line_end > index && (!data[line_end - 1] || std::isspace(static_cast<unsigned char>(data[line_end - 1]))))
+              --line_end;
+
+            if (line_end > index)
+            {
+              if (!persistence::serializable<persistence_backend::json, Element>::from_memory(transaction, data + index, line_end - index, element))
+              {
+                transaction.rollback();
+                return false;
+              }
+              transaction.complete();
+              output.push_back(std::move(*element));
+              element->~Element();
+            }
+            index = next_index;
+          }
+          return true;
+        }
+    };
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_1942276903518232417_2027467365__JSON_LINES_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
@@ -0,0 +1,380 @@
+//
+// file : json_number_utilities.hpp
+// in : file:///home/tim/projects/persistence/persistence/json_backend/json_number_utilities.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_8368115073681030076_161683214__JSON_NUMBER_UTILITIES_HPP__
+# define __N_8368115073681030076_161683214__JSON_NUMBER_UTILITIES_HPP__
+
+#include <type_traits>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cfloat>
+#include <cmath>
+#include <clocale>
+#include <string>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+# if __has_include(<charconv>)
+#   include <charconv>
+# endif
+#endif
+
+// Number <-> string conversions of the JSON backend
+//  They write / read directly from a buffer: no iostreams, no allocations (but for the floating point numbers
+//  of more than a hundred characters).
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      namespace json
+      {
+        /// \brief the size of a buffer that can hold any formatted number
+        static constexpr size_t max_number_length = 64;
+
+        /// \brief the powers of ten that are exactly representable by a double
+        static constexpr double powers_of_ten[] =
+        {
+          1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+          1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        // // serialization stuff
+
+        static const char digit_pairs[] =
+          "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+          "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+          "8081828384858687888990919293949596979899";
+
+        /// \brief write the digits of \e value backward, from \e end
+        /// \return the first character written
+        static inline char *format_digits(uint64_t value, char *end)
+        {
+          while (value >= 100)
+          {
+            const size_t pair = static_cast<size_t>(value % 100) * 2;
+            value /= 100;
+            *--end = digit_pairs[pair + 1];
+            *--end = digit_pairs[pair];
+          }
+          if (value >= 10)
+          {
+            *--end = digit_pairs[value * 2 + 1];
+            *--end = digit_pairs[value * 2];
+          }
+          else
+            *--end = static_cast<char>('0' + value);
+          return end;
+        }
+
+        /// \brief format an integer in \e buffer (of at least max_number_length characters)
+        /// \return the number of characters written
+        template<typename Type>
+        static inline typename std::enable_if<std::is_integral<Type>::value, size_t>::type number_to_string(Type value, char *buffer)
+        {
+          char digits[24];
+          char *const end = digits + sizeof(digits);
+          char *start;
+          if (value < 0)
+          {
+            // (0 - value) overflows for the minimum value, but not once in unsigned
+            start = format_digits(uint64_t(0) - static_cast<uint64_t>(value), end);
+            *--start = '-';
+          }
+          else
+            start = format_digits(static_cast<uint64_t>(value), end);
+          memcpy(buffer, start, end - start);
+          return end - start;
+        }
+
+        /// \brief the decimal point of the C locale: snprintf() writes it and strto*() expects it (it's a ',' in some locales)
+        static inline const char *_locale_decimal_point()
+        {
+          const char *point = localeconv()->decimal_point;
+          return (point && point[0] ? point : ".");
+        }
+
+        /// \brief replace the decimal point of the C locale by a '.' in the number written in \e buffer
+        /// \return the new length of the number
+        static inline int _to_json_decimal_point(char *buffer, int length)
+        {
+          const char *point = _locale_decimal_point();
+          if (length <= 0 || (point[0] == '.' && !point[1]))
+            return length;
+          char *it = strstr(buffer, point);
+          if (!it)
+            return length;
+          const size_t point_length = strlen(point);
+          *it = '.';
+          memmove(it + 1, it + point_length, length - (it - buffer) - point_length + 1); // (the \0 too)
+          return length - static_cast<int>(point_length - 1);
+        }
+
+        /// \brief copy the JSON number [\e number, \e number + \e size) in \e dest (of at least size + strlen(_locale_decimal_point()) + 1 characters),
+        /// with the decimal point of the C locale and a \0 (so strto*() can read it)
+        static inline void _from_json_decimal_point(const char *number, size_t size, char *dest)
+        {
+          const char *point = _locale_decimal_point();
+          const size_t point_length = strlen(point);
+          for (size_t i = 0; i < size; ++i)
+          {
+            if (number[i] == '.')
+            {
+              memcpy(dest, point, point_length);
+              dest += point_length;
+            }
+            else
+              *dest++ = number[i];
+          }
+          *dest = 0;
+        }
+
+        static inline int _print_float(char *buffer, int precision, double value)
+        {
+          return snprintf(buffer, max_number_length, "%.*g", precision, value);
+        }
+        static inline int _print_float(char *buffer, int precision, long double value)
+        {
+          return snprintf(buffer, max_number_length, "%.*Lg", precision, value);
+        }
+
+        static inline float _read_float(const char *number, char **end, float) { return std::strtof(number, end); }
+        static inline double _read_float(const char *number, char **end, double) { return std::strtod(number, end); }
+        static inline long double _read_float(const char *number, char **end, long double) { return std::strtold(number, end); }
+
+        /// \brief format a floating point number in \e buffer (of at least max_number_length characters)
+        /// using the shortest representation that reads back to the same value
+        /// \return the number of characters written
+        template<typename Type>
+        static inline typename std::enable_if<std::is_floating_point<Type>::value, size_t>::type number_to_string(Type value, char *buffer)
+        {
+#ifdef __cpp_lib_to_chars
+          const std::to_chars_result res = std::to_chars(buffer, buffer + max_number_length, value);
+          return res.ptr - buffer;
+#else
+          using print_type = typename std::conditional<std::is_same<Type, long double>::value, long double, double>::type;
+
+          // the fast path: the number has a few decimals (value = mantissa / 10^decimals, both exactly representable)
+          // the first number of decimals that reads back to the same value is the shortest representation
+          const bool is_float = std::is_same<Type, float>::value;
+          const Type magnitude = (std::signbit(value) ? -value : value);
+          if (FLT_EVAL_METHOD == 0 && !std::is_same<Type, long double>::value
+              && (magnitude == 0 || (magnitude >= Type(1e-4) && magnitude < Type(uint64_t(1) << (is_float ? 24 : 53)))))
+          {
+            const double max_mantissa = double(uint64_t(1) << (is_float ? 24 : 53));
+            const size_t max_decimals = (is_float ? 10 : 15);
+            for (size_t decimals = 0; decimals <= max_decimals; ++decimals)
+            {
+              const double scaled = std::nearbyint(double(magnitude) * powers_of_ten[decimals]);
+              if (scaled > max_mantissa)
+                break;
+              if (static_cast<Type>(scaled) / static_cast<Type>(powers_of_ten[decimals]) != magnitude)
+                continue;
+
+              // write the digits, then move the integer part in front of the decimal point
+              char digits[24];
+              char *const end = digits + sizeof(digits);
+              char *start = format_digits(static_cast<uint64_t>(scaled), end);
+              while (static_cast<size_t>(end - start) <= decimals)
+                *--start = '0';
+              char *it = buffer;
+              if (std::signbit(value))
+                *it++ = '-';
+              const size_t integer_length = (end - start) - decimals;
+              memcpy(it, start, integer_length);
+              it += integer_length;
+              if (decimals)
+              {
+                *it++ = '.';
+                memcpy(it, start + integer_length, decimals);
+                it += decimals;
+              }
+              return it - buffer;
+            }
+          }
+
+          // any number of at most digits10 digits reads back to itself, so the first precision that round-trips
+          // (starting at digits10) gives the shortest representation (%g drops the trailing zeros)
+          // (snprintf() and strto*() both follow the C locale: the decimal point is only changed to a '.' once the number is chosen)
+          if (std::isfinite(value))
+          {
+            for (int precision = std::numeric_limits<Type>::digits10; precision < std::numeric_limits<Type>::max_digits10; ++precision)
+            {
+              const int length = _print_float(buffer, precision, static_cast<print_type>(value));
+              if (_read_float(buffer, nullptr, Type()) == value)
+                return _to_json_decimal_point(buffer, length);
+            }
+          }
+          return _to_json_decimal_point(buffer, _print_float(buffer, std::numeric_limits<Type>::max_digits10, static_cast<print_type>(value)));
+#endif
+        }
+
+        // // deserialization stuff
+
+        /// \brief read an integer from [\e number, \e number + \e size)
+        /// The parsing stops at the first character that isn't a digit (like strtol does)
+        /// \return false if there's no number or if it doesn't fit in \e Type
+        template<typename Type>
+        static inline typename std::enable_if<std::is_integral<Type>::value, bool>::type number_from_string(const char *number, size_t size, Type &dest)
+        {
+          size_t i = 0;
+          const bool negative = (size && number[0] == '-');
+          if (negative)
+          {
+            if (!std::is_signed<Type>::value)
+              return false;
+            ++i;
+          }
+          if (i >= size || number[i] < '0' || number[i] > '9')
+            return false;
+
+          // the magnitude of the minimum value is one more than the maximum
+          const uint64_t limit = static_cast<uint64_t>(std::numeric_limits<Type>::max()) + (negative ? 1 : 0);
+          uint64_t value = 0;
+          for (; i < size && number[i] >= '0' && number[i] <= '9'; ++i)
+          {
+            const unsigned digit = static_cast<unsigned>(number[i] - '0');
+            if (value > (limit - digit) / 10)
+              return false;
+            value = value * 10 + digit;
+          }
+
+          if (negative)
+            dest = static_cast<Type>(-static_cast<int64_t>(value - 1) - 1);
+          else
+            dest = static_cast<Type>(value);
+          return true;
+        }
+
+        /// \brief read a floating point number from [\e number, \e number + \e size)
+        /// \return false if there's no number or if it doesn't fit in \e Type
+        template<typename Type>
+        static inline typename std::enable_if<std::is_floating_point<Type>::value, bool>::type number_from_string(const char *number, size_t size, Type &dest)
+        {
+#ifdef __cpp_lib_to_chars
+          const std::from_chars_result res = std::from_chars(number, number + size, dest);
+          if (res.ec != std::errc())
+            return false;
+          // (from_chars() stops before an exponent without digits: 1e is not 1)
+          return res.ptr == number + size || (*res.ptr != 'e' && *res.ptr != 'E');
+#else
+          // scan the number: [-] digits [. digits] [(e|E) [+|-] digits]
+          size_t i = 0;
+          const bool negative = (size && number[0] == '-');
+          if (negative)
+            ++i;
+          if (i >= size || number[i] < '0' || number[i] > '9')
+            return false;
+
+          uint64_t mantissa = 0;
+          bool exact = true; // the mantissa has not been truncated
+          int64_t exponent = 0;
+          for (; i < size && number[i] >= '0' && number[i] <= '9'; ++i)
+          {
+            if (mantissa >= (uint64_t(1) << 59))
+              exact = false;
+            else
+              mantissa = mantissa * 10 + static_cast<unsigned>(number[i] - '0');
+            if (!exact)
+              ++exponent;
+          }
+          if (i < size && number[i] == '.')
+          {
+            for (++i; i < size && number[i] >= '0' && number[i] <= '9'; ++i)
+            {
+              if (mantissa >= (uint64_t(1) << 59))
+                exact = false;
+              if (exact)
+              {
+                mantissa = mantissa * 10 + static_cast<unsigned>(number[i] - '0');
+                --exponent;
+              }
+            }
+          }
+          if (i < size && (number[i] == 'e' || number[i] == 'E'))
+          {
+            size_t j = i + 1;
+            const bool negative_exponent = (j < size && number[j] == '-');
+            if (j < size && (number[j] == '-' || number[j] == '+'))
+              ++j;
+            if (j >= size || number[j] < '0' || number[j] > '9') // (an exponent without digits)
+              return false;
+            int64_t explicit_exponent = 0;
+            for (; j < size && number[j] >= '0' && number[j] <= '9'; ++j)
+            {
+              if (explicit_exponent < 100000)
+                explicit_exponent = explicit_exponent * 10 + (number[j] - '0');
+            }
+            exponent += (negative_exponent ? -explicit_exponent : explicit_exponent);
+            i = j;
+          }
+
+          // the fast path: the mantissa and the power of ten are exactly representable,
+          // so a single multiplication / division is correctly rounded (Clinger)
+          const bool is_float = std::is_same<Type, float>::value;
+          const int64_t max_exponent = (is_float ? 10 : 22);
+          const uint64_t max_mantissa = uint64_t(1) << (is_float ? 24 : 53);
+          if (FLT_EVAL_METHOD == 0 && !std::is_same<Type, long double>::value
+              && exact && mantissa <= max_mantissa && exponent >= -max_exponent && exponent <= max_exponent)
+          {
+            Type value = static_cast<Type>(mantissa);
+            if (exponent < 0)
+              value /= static_cast<Type>(powers_of_ten[-exponent]);
+            else
+              value *= static_cast<Type>(powers_of_ten[exponent]);
+            dest = (negative ? -value : value);
+            return true;
+          }
+
+          // the slow path (strto* needs a terminated string, with the decimal point of the C locale:
+          // the numbers that don't fit in the buffer are copied on the heap)
+          char buffer[max_number_length * 2];
+          std::string long_number;
+          char *terminated = buffer;
+          const size_t copy_size = i + strlen(_locale_decimal_point()) + 1;
+          if (copy_size > sizeof(buffer))
+          {
+            long_number.resize(copy_size);
+            terminated = &long_number[0];
+          }
+          _from_json_decimal_point(number, i, terminated);
+          dest = _read_float(terminated, nullptr, Type());
+          return !std::isinf(dest);
+#endif
+        }
+      } // namespace json
+    } // namespace internal
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_8368115073681030076_161683214__JSON_NUMBER_UTILITIES_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
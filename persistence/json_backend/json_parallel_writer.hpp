@@ -0,0 +1,173 @@
+//
+// file : json_parallel_writer.hpp
+// in : file:///home/tim/projects/persistence/persistence/json_backend/json_parallel_writer.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_1308297418863416735_1127640297__JSON_PARALLEL_WRITER_HPP__
+# define __N_1308297418863416735_1127640297__JSON_PARALLEL_WRITER_HPP__
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "../tools/memory_allocator.hpp"
+#include "../parallel.hpp"
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      namespace json
+      {
+        /// \brief the default threshold of set_json_parallel_threshold(): below that number of elements, splitting a list isn't worth it
+        constexpr size_t parallel_writer_min_element_count = 16 * 1024;
+        /// \brief the minimum number of elements written by a single job
+        constexpr size_t parallel_writer_min_part_size = 4 * 1024;
+
+        /// \brief write the elements of a list or a collection in parallel, each part in its own buffer.
+        /// The buffers are then appended in order, so the output is the same as the one of a sequential write.
+        /// Only the outermost big container of a document is split: the containers it holds are written by the thread
+        /// that writes their part.
+        class parallel_writer
+        {
+          public:
+            /// \brief return true if the \e element_count elements should be written in parallel
+            static bool should_split(size_t element_count)
+            {
+              const size_t threshold = min_element_count().load(std::memory_order_relaxed);
+              return threshold && element_count >= std::max(threshold, 2 * parallel_writer_min_part_size)
+                     && !in_part() && std::thread::hardware_concurrency() > 1;
+            }
+
+            /// \brief the number of elements from which a list or a collection is written in parallel (0: never)
+            static std::atomic<size_t> &min_element_count()
+            {
+              static std::atomic<size_t> value {0};
+              return value;
+            }
+
+            /// \brief write \e element_count elements, starting at \e it
+            /// \param write_element bool (memory_allocator &mem, size_t &size, Iterator &it, size_t index): write a single element (with its separator)
+            /// \param increment bool (Iterator &it): go to the next element
+            /// \note at the end, \e it is where a sequential write would have left it
+            template<typename Iterator, typename WriteFunc, typename IncrementFunc>
+            static bool write(memory_allocator &mem, size_t &size, size_t element_count, Iterator &it, WriteFunc &&write_element, IncrementFunc &&increment)
+            {
+              size_t part_count = element_count / parallel_writer_min_part_size;
+              const size_t max_part_count = std::thread::hardware_concurrency() * 8;
+              if (part_count > max_part_count)
+                part_count = max_part_count;
+              const size_t part_size = (element_count + part_count - 1) / part_count;
+
+              // the iterators to the start of each part (they are only incremented, so going through them is cheap)
+              std::vector<Iterator> part_starts;
+              part_starts.reserve(part_count);
+              for (size_t index = 0; index < element_count; ++index)
+              {
+                if (index % part_size == 0)
+                  part_starts.push_back(it);
+                if (!increment(it))
+                  return false;
+              }
+
+              std::deque<memory_allocator> parts(part_starts.size()); // (memory_allocator can't be moved around by a vector)
+              std::atomic<bool> failed(false);
+              internal::parallel_for(parts.size(), parallel_threshold, [&](size_t i)
+              {
+                part_scope scope;
+                Iterator part_it = part_starts[i];
+                const size_t end_index = std::min(element_count, (i + 1) * part_size);
+                for (size_t index = i * part_size; index < end_index && !failed; ++index)
+                {
+                  size_t element_size = 0;
+                  if (!write_element(parts[i], element_size, part_it, index) || (index + 1 < end_index && !increment(part_it)))
+                  {
+                    failed = true;
+                    return;
+                  }
+                }
+                if (parts[i].has_failed())
+                  failed = true;
+              });
+              if (failed)
+                return false;
+
+              for (auto &it : parts)
+              {
+                const size_t written = it.size();
+                if (!written)
+                  continue;
+                void *dest = mem.allocate(written);
+                if (!dest)
+                  return false;
+                memcpy(dest, it.get_contiguous_data(), written);
+                size += written;
+              }
+              return true;
+            }
+
+          private:
+            /// \brief true when the calling thread is writing a part of a container
+            static bool &in_part()
+            {
+              static thread_local bool value = false;
+              return value;
+            }
+
+            /// \brief mark the calling thread as writing a part (for the lifetime of the scope)
+            class part_scope
+            {
+              public:
+                part_scope() : previous(in_part()) { in_part() = true; }
+                ~part_scope() { in_part() = previous; }
+
+                part_scope(const part_scope &) = delete;
+                part_scope &operator = (const part_scope &) = delete;
+
+              private:
+                bool previous;
+            };
+        };
+      } // namespace json
+    } // namespace internal
+
+    /// \brief write the JSON lists and collections of at least \e min_element_count elements with all the cores
+    /// (the output is the same as the one of a single thread). 0, the default, writes everything on the calling thread.
+    /// \note the elements of a list are then serialized concurrently: their serializers must not modify any shared state
+    inline void set_json_parallel_threshold(size_t min_element_count = internal::json::parallel_writer_min_element_count)
+    {
+      internal::json::parallel_writer::min_element_count() = min_element_count;
+    }
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_1308297418863416735_1127640297__JSON_PARALLEL_WRITER_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
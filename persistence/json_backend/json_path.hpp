@@ -0,0 +1,334 @@
+//
+// file : json_path.hpp
+// in : file:///home/tim/projects/persistence/persistence/json_backend/json_path.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_2096415780227313498_1544087253__JSON_PATH_HPP__
+# define __N_2096415780227313498_1544087253__JSON_PATH_HPP__
+
+#include <cstddef>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <type_traits>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "../object.hpp" // for my IDE
+#include "serializable_specs_json.hpp"
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      namespace json
+      {
+        /// \brief an element of a path: the name of an object member, or the index of an array element
+        /// (names made of digits are also accepted as array indexes, a negative index matches nothing)
+        struct path_component
+        {
+          path_component(const char *_name) : name(_name), size(strlen(_name)) {}
+          path_component(const std::string &_name) : name(_name.data()), size(_name.size()) {}
+          template<typename Integer, typename = typename std::enable_if<std::is_integral<Integer>::value>::type>
+          path_component(Integer _index) : index(static_cast<size_t>(_index)), is_index(std::is_unsigned<Integer>::value || static_cast<long long>(_index) >= 0) {}
+
+          /// \brief false for a negative index (it is neither a name nor an index)
+          bool is_valid() const
+          {
+            return name || is_index;
+          }
+
+          /// \brief return the array index of the component (false if it isn't one)
+          bool get_index(size_t &res) const
+          {
+            if (is_index || !name)
+            {
+              res = index;
+              return is_index;
+            }
+            for (size_t i = 0; i < size; ++i)
+            {
+              if (name[i] < '0' || name[i] > '9')
+                return false;
+            }
+            return size && number_from_string(name, size, res);
+          }
+
+          const char *name = nullptr;
+          size_t size = 0;
+          size_t index = 0;
+          bool is_index = false;
+        };
+
+        /// \brief return the index of the first '"', '[', ']', '{' or '}' of [\e s + \e index, \e s + \e size) (or \e size)
+        static inline size_t find_structural(const char *s, size_t size, size_t index)
+        {
+#ifdef __SSE2__
+          const __m128i quote = _mm_set1_epi8('"');
+          const __m128i open_bracket = _mm_set1_epi8('[');
+          const __m128i close_bracket = _mm_set1_epi8(']');
+          const __m128i open_brace = _mm_set1_epi8('{');
+          const __m128i close_brace = _mm_set1_epi8('}');
+          for (; index + 16 <= size; index += 16)
+          {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + index));
+            const __m128i brackets = _mm_or_si128(_mm_cmpeq_epi8(chunk, open_bracket), _mm_cmpeq_epi8(chunk, close_bracket));
+            const __m128i braces = _mm_or_si128(_mm_cmpeq_epi8(chunk, open_brace), _mm_cmpeq_epi8(chunk, close_brace));
+            const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_or_si128(brackets, braces))));
+            if (mask)
+            {
+# if defined(__GNUC__) || defined(__clang__)
+              return index + __builtin_ctz(mask);
+# else
+              unsigned i = 0;
+              for (; !(mask & (1u << i)); ++i);
+              return index + i;
+# endif
+            }
+          }
+#endif
+          for (; index < size; ++index)
+          {
+            switch (s[index])
+            {
+              case '"': case '[': case ']': case '{': case '}':
+                return index;
+            }
+          }
+          return index;
+        }
+
+        static inline void skip_whitespaces(const char *memory, size_t size, size_t &index)
+        {
+          for (; index < size && std::isspace(static_cast<unsigned char>(memory[index])); ++index);
+        }
+
+        /// \brief move \e index (just after an opening quotation mark) to the closing quotation mark
+        static inline bool skip_string(const char *memory, size_t size, size_t &index)
+        {
+          while (true)
+          {
+            index = find_unescape(memory, size, index);
+            if (index >= size)
+              return false;
+            if (memory[index] == '"')
+              return true;
+            index += 2; // skip the escape sequence
+          }
+        }
+
+        /// \brief move \e index (at the start of a value) just after the end of the value, without looking at its content
+        static inline bool skip_value(const char *memory, size_t size, size_t &index)
+        {
+          switch (memory[index])
+          {
+            case '"':
+              ++index;
+              if (!skip_string(memory, size, index))
+                return false;
+              ++index;
+              return true;
+            case '[': case '{':
+            {
+              std::string brackets; // the opening brackets of the lists / collections the scan is in
+              for (; (index = find_structural(memory, size, index)) < size; ++index)
+              {
+                switch (memory[index])
+                {
+                  case '"':
+                    ++index;
+                    if (!skip_string(memory, size, index))
+                      return false;
+                    break;
+                  case '[': case '{':
+                    brackets.push_back(memory[index]);
+                    break;
+                  default:
+                    if ((brackets.back() ^ memory[index]) != ('[' ^ ']')) // a ']' that closes a '{' (or the opposite)
+                      return false;
+                    brackets.pop_back();
+                    if (brackets.empty())
+                    {
+                      ++index;
+                      return true;
+                    }
+                }
+              }
+              return false;
+            }
+            default: // numbers, true, false and null
+            {
+              const size_t start = index;
+              for (; index < size; ++index)
+              {
+                const char c = memory[index];
+                if (c == ',' || c == ']' || c == '}' || !c || std::isspace(static_cast<unsigned char>(c)))
+                  break;
+              }
+              return index > start;
+            }
+          }
+        }
+
+        /// \brief find the member (or the element) \e component of the object (or the array) [\e memory, \e memory + \e size)
+        /// The values before the searched one are skipped, not deserialized.
+        static inline bool find_child(const char *memory, size_t size, const path_component &component, const char *&value, size_t &value_size)
+        {
+          if (!component.is_valid())
+            return false;
+
+          size_t index = 0;
+          skip_whitespaces(memory, size, index);
+          if (index >= size)
+            return false;
+
+          const char opening = memory[index];
+          size_t element_index = 0;
+          if (opening == '[' && !component.get_index(element_index))
+            return false;
+          if (opening != '[' && opening != '{')
+            return false;
+
+          ++index;
+          for (size_t i = 0; ; ++i)
+          {
+            skip_whitespaces(memory, size, index);
+            if (index >= size || memory[index] == ']' || memory[index] == '}')
+              return false;
+
+            bool found = (opening == '[' && i == element_index);
+            if (opening == '{')
+            {
+              // the key
+              if (memory[index] != '"')
+                return false;
+              const size_t key_start = index++;
+              if (!skip_string(memory, size, index))
+                return false;
+              ++index;
+
+              if (component.name)
+              {
+                persistence::key_reader<persistence_backend::json>::read(memory + key_start, index - key_start, [&](const char *name, size_t name_size)
+                {
+                  found = (name_size == component.size && !memcmp(name, component.name, name_size));
+                });
+              }
+              else
+              {
+                char digits[max_number_length];
+                const size_t digit_count = number_to_string(component.index, digits);
+                found = (index - key_start == digit_count + 2 && !memcmp(memory + key_start + 1, digits, digit_count));
+              }
+
+              skip_whitespaces(memory, size, index);
+              if (index >= size || memory[index] != ':')
+                return false;
+              ++index;
+              skip_whitespaces(memory, size, index);
+              if (index >= size)
+                return false;
+            }
+
+            // the value
+            const size_t value_start = index;
+            if (!skip_value(memory, size, index))
+              return false;
+            if (found)
+            {
+              value = memory + value_start;
+              value_size = index - value_start;
+              return true;
+            }
+
+            skip_whitespaces(memory, size, index);
+            if (index >= size || memory[index] != ',')
+              return false;
+            ++index;
+          }
+        }
+      } // namespace json
+    } // namespace internal
+
+    /// \brief find the JSON value at \e path in \e data, without deserializing anything
+    /// \code
+    /// const char *value;
+    /// size_t value_size;
+    /// if (json_find(data, value, value_size, "s_map", "42", "s_vector", 3))
+    ///   route(value, value_size);
+    /// \endcode
+    /// \param path the names of the object members and the indexes of the array elements to go through
+    /// \return false if the path isn't in the document (or if the document isn't well formatted on the way to the value)
+    template<typename... Path>
+    inline bool json_find(const raw_data &data, const char *&value, size_t &value_size, const Path &... path)
+    {
+      const internal::json::path_component components[] = {internal::json::path_component(path)..., internal::json::path_component("")};
+      value = reinterpret_cast<const char *>(data.data);
+      value_size = data.size;
+      if (!value)
+        return false;
+      for (size_t i = 0; i < sizeof...(Path); ++i)
+      {
+        if (!internal::json::find_child(value, value_size, components[i], value, value_size))
+          return false;
+      }
+      return true;
+    }
+
+    /// \brief deserialize only the JSON value at \e path in \e data (the siblings of the path are skipped, not deserialized)
+    /// \code
+    /// int *value = json_at<int>(data, "s_map", "42", "s_int");
+    /// \endcode
+    /// \return nullptr when the path isn't in the document or when the value can't be deserialized
+    /// \note It's up to you to \b delete the returned object !!! (as with persistence::deserialize())
+    template<typename Type, typename... Path>
+    inline Type *json_at(const raw_data &data, const Path &... path)
+    {
+      const char *value;
+      size_t value_size;
+      if (!json_find(data, value, value_size, path...))
+        return nullptr;
+
+      cr::allocation_transaction transaction;
+      Type *ptr = reinterpret_cast<Type *>(transaction.allocate_raw(sizeof(Type)));
+      if (!ptr)
+        return nullptr;
+      if (!persistence::serializable<persistence_backend::json, Type>::from_memory(transaction, value, value_size, ptr))
+      {
+        transaction.rollback();
+        return nullptr;
+      }
+      transaction.complete();
+      return ptr;
+    }
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_2096415780227313498_1544087253__JSON_PATH_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
@@ -0,0 +1,348 @@
+//
+// file : json_stream_reader.hpp
+// in : file:///home/tim/projects/persistence/persistence/json_backend/json_stream_reader.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_4752955921141253175_1409404901__JSON_STREAM_READER_HPP__
+# define __N_4752955921141253175_1409404901__JSON_STREAM_READER_HPP__
+
+#include <cstddef>
+#include <cctype>
+#include <string>
+#include <fstream>
+#include <functional>
+#include <type_traits>
+
+#include "../object.hpp" // for my IDE
+#include "serializable_specs_json.hpp"
+
+namespace neam
+{
+  namespace cr
+  {
+    /// \brief read a JSON array of \e Element as its data arrives, chunk by chunk
+    /// Each element is deserialized (by the JSON backend) as soon as its last byte has been fed, then given to the callback.
+    /// Only the element being read is kept in memory (and only the part of it that was in the previous chunks),
+    /// so the memory use doesn't depend on the size of the document.
+    /// \code
+    /// json_stream_reader<record> reader([&](record &r) { process(r); return true; });
+    /// while (size_t size = receive(buffer, sizeof(buffer)))
+    /// {
+    ///   if (!reader.feed(buffer, size))
+    ///     return false;
+    /// }
+    /// return reader.end();
+    /// \endcode
+    /// \note the document must be an array (only its elements are streamed)
+    template<typename Element>
+    class json_stream_reader
+    {
+      public:
+        /// \brief called with each deserialized element (that is destructed once the callback returns)
+        /// Returning false stops the reading.
+        using callback_t = std::function<bool (Element &)>;
+
+        /// \param[in] _max_element_size the maximum size of a single (serialized) element
+        explicit json_stream_reader(callback_t _callback, size_t _max_element_size = 64 * 1024 * 1024)
+          : callback(std::move(_callback)), max_element_size(_max_element_size)
+        {
+        }
+
+        /// \brief read the next chunk of the document
+        /// \return false if the document is not well formatted, if an element can't be deserialized
+        ///         or is bigger than the maximum element size, or if the callback has stopped the reading
+        bool feed(const char *data, size_t size)
+        {
+          size_t i = 0;
+          size_t element_start = 0; // (the start of the current element, in this chunk)
+          while (i < size && state != states::failed)
+          {
+            switch (state)
+            {
+              case states::before_array:
+                if (data[i] == '[')
+                  state = states::before_first_element;
+                else if (!std::isspace(static_cast<unsigned char>(data[i])))
+                  return _fail();
+                ++i;
+                break;
+
+              case states::before_first_element:
+              case states::before_element:
+                if (std::isspace(static_cast<unsigned char>(data[i])))
+                {
+                  ++i;
+                  break;
+                }
+                if (data[i] == ']' && state == states::before_first_element)
+                {
+                  state = states::done; // (an empty array)
+                  ++i;
+                  break;
+                }
+                if (data[i] == ']' || data[i] == ',')
+                  return _fail();
+
+                // the start of an element
+                state = states::in_element;
+                element_start = i;
+                brackets.clear();
+                in_string = false;
+                escaped = false;
+                break;
+
+              case states::in_element:
+              {
+                size_t element_end = 0;
+                if (_scan(data, size, i, element_end))
+                {
+                  if (!_element(data + element_start, element_end - element_start, element_end == size))
+                    return _fail();
+                  state = states::after_element;
+                  i = element_end;
+                }
+                break;
+              }
+
+              case states::after_element:
+                if (data[i] == ',')
+                  state = states::before_element;
+                else if (data[i] == ']')
+                  state = states::done;
+                else if (!std::isspace(static_cast<unsigned char>(data[i])))
+                  return _fail();
+                ++i;
+                break;
+
+              case states::done: // (the serializer ends its output with a '\0')
+                if (data[i] && !std::isspace(static_cast<unsigned char>(data[i])))
+                  return _fail();
+                ++i;
+                break;
+
+              case states::failed:
+                break;
+            }
+          }
+
+          // keep the beginning of the element for the next chunks
+          if (state == states::in_element)
+          {
+            if (pending.size() + (size - element_start) > max_element_size)
+              return _fail();
+            pending.append(data + element_start, size - element_start);
+          }
+          return state != states::failed;
+        }
+
+        /// \brief read the next chunk of the document
+        bool feed(const raw_data &chunk)
+        {
+          return feed(reinterpret_cast<const char *>(chunk.data), chunk.size);
+        }
+
+        /// \brief tell the reader that the whole document has been fed
+        /// \return true if the whole array has been read
+        bool end()
+        {
+          // a document can't end in an element: the array is never closed
+          return state == states::done;
+        }
+
+        /// \brief read the document from a file, \e chunk_size bytes at a time
+        /// \return true if the whole array has been read
+        bool read_file(const std::string &path, size_t chunk_size = 1024 * 1024)
+        {
+          std::ifstream file(path, std::ios_base::binary);
+          if (!file)
+            return false;
+          std::string chunk(chunk_size, '\0');
+          while (file)
+          {
+            file.read(&chunk[0], chunk_size);
+            const size_t read_size = static_cast<size_t>(file.gcount());
+            if (read_size && !feed(chunk.data(), read_size))
+              return false;
+          }
+          return end();
+        }
+
+        /// \brief return the number of elements that have been given to the callback
+        size_t get_element_count() const
+        {
+          return element_count;
+        }
+
+        /// \brief return true if the reading has failed (or has been stopped by the callback)
+        bool has_failed() const
+        {
+          return state == states::failed;
+        }
+
+      private:
+        /// \brief scan the element from \e i. Return true if it ends in this chunk (\e element_end is then set)
+        /// The state of the scan (brackets, strings, escapes) is kept from one chunk to the next.
+        /// A closing bracket that doesn't match its opening one makes the reading fail.
+        bool _scan(const char *data, size_t size, size_t &i, size_t &element_end)
+        {
+          for (; i < size; ++i)
+          {
+            if (escaped)
+            {
+              escaped = false;
+              continue;
+            }
+            if (in_string)
+            {
+              // skip the characters that can't end the string
+              i = internal::json::find_unescape(data, size, i);
+              if (i == size)
+                return false;
+              if (data[i] == '\\')
+              {
+                escaped = true;
+                continue;
+              }
+              in_string = false;
+              if (brackets.empty()) // (the element is a string)
+              {
+                element_end = i + 1;
+                return true;
+              }
+              continue;
+            }
+
+            switch (data[i])
+            {
+              case '"':
+                in_string = true;
+                break;
+              case '[': case '{':
+                brackets.push_back(data[i]);
+                break;
+              case ']': case '}':
+                if (brackets.empty()) // the end of the array, just after a number, true, false or null
+                {
+                  element_end = i;
+                  return true;
+                }
+                if ((brackets.back() ^ data[i]) != ('[' ^ ']')) // a ']' that closes a '{' (or the opposite)
+                {
+                  _fail();
+                  return false;
+                }
+                brackets.pop_back();
+                if (brackets.empty())
+                {
+                  element_end = i + 1;
+                  return true;
+                }
+                break;
+              case ',':
+                if (brackets.empty())
+                {
+                  element_end = i;
+                  return true;
+                }
+                break;
+              default:
+                if (brackets.empty() && std::isspace(static_cast<unsigned char>(data[i])))
+                {
+                  element_end = i;
+                  return true;
+                }
+            }
+          }
+          return false;
+        }
+
+        /// \brief deserialize an element and give it to the callback
+        /// \param[in] at_chunk_end true if the element ends with the chunk (the deserializer may read the byte after the element)
+        bool _element(const char *memory, size_t size, bool at_chunk_end)
+        {
+          if (!pending.empty() || at_chunk_end)
+          {
+            if (pending.size() + size > max_element_size)
+              return false;
+            pending.append(memory, size);
+            memory = pending.data();
+            size = pending.size();
+          }
+          else if (size > max_element_size)
+            return false;
+
+          cr::allocation_transaction transaction;
+          typename std::aligned_storage<sizeof(Element), alignof(Element)>::type element_memory;
+          Element *element = reinterpret_cast<Element *>(&element_memory);
+          if (!persistence::serializable<persistence_backend::json, Element>::from_memory(transaction, memory, size, element))
+          {
+            transaction.rollback();
+            return false;
+          }
+          transaction.complete();
+          pending.clear();
+
+          ++element_count;
+          const bool res = callback(*element);
+          element->~Element();
+          return res;
+        }
+
+        bool _fail()
+        {
+          state = states::failed;
+          pending.clear();
+          return false;
+        }
+
+      private:
+        enum class states
+        {
+          before_array,
+          before_first_element,
+          before_element,
+          in_element,
+          after_element,
+          done,
+          failed,
+        };
+
+        callback_t callback;
+        size_t max_element_size;
+
+        states state = states::before_array;
+        size_t element_count = 0;
+
+        // the scan of the current element
+        std::string pending; ///< the part of the current element that was in the previous chunks
+        std::string brackets; ///< the opening brackets of the lists / collections the scan is in
+        bool in_string = false;
+        bool escaped = false;
+    };
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_4752955921141253175_1409404901__JSON_STREAM_READER_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
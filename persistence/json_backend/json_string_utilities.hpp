@@ -34,8 +34,13 @@
 #include <string>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
 #include <cctype>
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 // This file is mostly serialization oriented
 //  With a bit of deserialization
 
@@ -48,99 +53,306 @@ namespace neam
       namespace json
       {
         static char hex_alphabet[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
-        static inline std::string escape_string(const std::string &s)
+
+        /// \brief true if \e c has to be escaped (control characters, non-ASCII bytes, '"' and '\\')
+        static inline bool needs_escape(char c)
+        {
+          return static_cast<unsigned char>(c) < ' ' || static_cast<unsigned char>(c) >= 0x80 || c == '"' || c == '\\';
+        }
+
+        /// \brief return the index of the first character of [\e s + \e index, \e s + \e size) that has to be escaped (or \e size)
+        static inline size_t find_escape(const char *s, size_t size, size_t index)
         {
-          std::string res;
-          res.reserve(s.size());
-          for (size_t i = 0; i < s.size(); ++i)
+#ifdef __SSE2__
+          const __m128i quote = _mm_set1_epi8('"');
+          const __m128i backslash = _mm_set1_epi8('\\');
+          const __m128i space = _mm_set1_epi8(' '); // (a signed comparison: the non-ASCII bytes are also lower than that)
+          for (; index + 16 <= size; index += 16)
           {
-            if (((std::isgraph(s[i]) || s[i] >= ' ') && s[i] != '"' && s[i] != '\\') || s[i] == ' ')
-              res += s[i];
-            else if (s[i] != '"' && s[i] != '\\')
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + index));
+            const __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)), _mm_cmplt_epi8(chunk, space));
+            const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+            if (mask)
             {
-              switch (s[i])
-              {
-                case '\b': res += "\\b"; break;
-                case '\f': res += "\\f"; break;
-                case '\n': res += "\\n"; break;
-                case '\r': res += "\\r"; break;
-                case '\t': res += "\\t"; break;
-                default:
-                  res += "\\u00";
-                  res += internal::json::hex_alphabet[(s[i] & 0xF0) >> 4];
-                  res += internal::json::hex_alphabet[s[i] & 0x0F];
-              }
+# if defined(__GNUC__) || defined(__clang__)
+              return index + __builtin_ctz(mask);
+# else
+              unsigned i = 0;
+              for (; !(mask & (1u << i)); ++i);
+              return index + i;
+# endif
             }
-            else
+          }
+#endif
+          for (; index < size && !needs_escape(s[index]); ++index);
+          return index;
+        }
+
+        /// \brief write the escape sequence of \e c in \e dest (if \e dest isn't null)
+        /// \return the size of the escape sequence
+        static inline size_t escape_char(char c, char *dest)
+        {
+          char code = 0;
+          switch (c)
+          {
+            case '\b': code = 'b'; break;
+            case '\f': code = 'f'; break;
+            case '\n': code = 'n'; break;
+            case '\r': code = 'r'; break;
+            case '\t': code = 't'; break;
+            case '"': case '\\': code = c; break;
+          }
+          if (code)
+          {
+            if (dest)
             {
-              res += "\\";
-              res += s[i];
+              dest[0] = '\\';
+              dest[1] = code;
             }
+            return 2;
+          }
+          if (dest)
+          {
+            memcpy(dest, "\\u00", 4);
+            dest[4] = hex_alphabet[(c & 0xF0) >> 4];
+            dest[5] = hex_alphabet[c & 0x0F];
+          }
+          return 6;
+        }
+
+        /// \brief return the size of [\e s, \e s + \e size) once escaped
+        static inline size_t escaped_size(const char *s, size_t size)
+        {
+          size_t res = size;
+          for (size_t i = find_escape(s, size, 0); i < size; i = find_escape(s, size, i + 1))
+            res += escape_char(s[i], nullptr) - 1;
+          return res;
+        }
+
+        /// \brief escape [\e s, \e s + \e size) into \e dest (that must be at least escaped_size() long)
+        /// The runs of characters that don't need to be escaped are copied as a whole
+        /// \return the end of the escaped string
+        static inline char *escape_to(char *dest, const char *s, size_t size)
+        {
+          size_t i = 0;
+          while (i < size)
+          {
+            const size_t next = find_escape(s, size, i);
+            memcpy(dest, s + i, next - i);
+            dest += next - i;
+            if (next == size)
+              break;
+            dest += escape_char(s[next], dest);
+            i = next + 1;
           }
+          return dest;
+        }
+
+        static inline std::string escape_string(const std::string &s)
+        {
+          std::string res(escaped_size(s.data(), s.size()), '\0');
+          escape_to(&res[0], s.data(), s.size());
           return res;
         }
 
-        static inline std::string unescape_string(const char *s, size_t size)
+        /// \brief return the index of the first '"' or '\\' of [\e s + \e index, \e s + \e size) (or \e size)
+        static inline size_t find_unescape(const char *s, size_t size, size_t index)
         {
-          std::string res;
-          res.reserve(size);
-          for (size_t i = 0; i < size; ++i)
+#ifdef __SSE2__
+          const __m128i quote = _mm_set1_epi8('"');
+          const __m128i backslash = _mm_set1_epi8('\\');
+          for (; index + 16 <= size; index += 16)
           {
-            if (s[i] == '\\' && i + 1 < size)
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + index));
+            const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash))));
+            if (mask)
             {
-              ++i;
-              switch (s[i])
+# if defined(__GNUC__) || defined(__clang__)
+              return index + __builtin_ctz(mask);
+# else
+              unsigned i = 0;
+              for (; !(mask & (1u << i)); ++i);
+              return index + i;
+# endif
+            }
+          }
+#endif
+          for (; index < size && s[index] != '"' && s[index] != '\\'; ++index);
+          return index;
+        }
+
+        /// \brief unescape the content of a JSON string (\e s is just after its opening quotation mark) into \e dest
+        /// The unescaping stops at the closing quotation mark (or at the end of the memory area).
+        /// \e dest must be at least \e size long: the unescaped string can't be longer than the escaped one
+        /// \param[out] dest_size the size of the unescaped string
+        /// \return false if an escape sequence is malformed
+        static inline bool unescape_to(char *dest, size_t &dest_size, const char *s, size_t size)
+        {
+          size_t d = 0;
+          size_t i = 0;
+          while (i < size)
+          {
+            // copy the run of characters that doesn't have to be unescaped
+            const size_t next = find_unescape(s, size, i);
+            memcpy(dest + d, s + i, next - i);
+            d += next - i;
+            if (next == size || s[next] == '"')
+              break;
+
+            if (next + 1 >= size)
+              return false;
+            i = next + 2;
+            switch (s[next + 1])
+            {
+              case '\\': case '"': case '/': dest[d++] = s[next + 1]; break;
+              case 'b': dest[d++] = '\b'; break;
+              case 'f': dest[d++] = '\f'; break;
+              case 'n': dest[d++] = '\n'; break;
+              case 'r': dest[d++] = '\r'; break;
+              case 't': dest[d++] = '\t'; break;
+              case 'u':
               {
-                case '\\': case '"': res += s[i];break;
-                case 'b': res += '\b'; break;
-                case 'f': res += '\f'; break;
-                case 'n': res += '\n'; break;
-                case 'r': res += '\r'; break;
-                case 't': res += '\t'; break;
-                case 'u':
-                  ++i;
-                  if (i + 3 >= size)
-                    return res;
-                  char data[5] = {res[i], res[i + 1], res[1 + 2], res[1 + 3], 0};
-                  char *_u = data;
-                  uint16_t t = static_cast<uint16_t>(strtoul(data, &_u, 16));
-                  if (t & 0xFF00)
-                    res += char(t >> 8);
-                  res += char(t & 0xFF);
-                  i += 3;
-                  break;
+                if (i + 4 > size)
+                  return false;
+                uint16_t t = 0;
+                for (const size_t end = i + 4; i < end; ++i)
+                {
+                  const char c = s[i];
+                  if (c >= '0' && c <= '9') t = (t << 4) | (c - '0');
+                  else if (c >= 'a' && c <= 'f') t = (t << 4) | (c - 'a' + 10);
+                  else if (c >= 'A' && c <= 'F') t = (t << 4) | (c - 'A' + 10);
+                  else return false;
+                }
+                if (t & 0xFF00)
+                  dest[d++] = char(t >> 8);
+                dest[d++] = char(t & 0xFF);
+                break;
               }
+              default:
+                return false;
             }
-            else
-              res += s[i];
           }
+          dest_size = d;
+          return true;
+        }
+
+        static inline std::string unescape_string(const char *s, size_t size)
+        {
+          std::string res(size, '\0');
+          size_t res_size = 0;
+          if (size)
+            unescape_to(&res[0], res_size, s, size);
+          res.resize(res_size);
           return res;
         }
 
-        static inline bool _allocate_string(memory_allocator &mem, size_t &size, size_t indent_level, const std::string &data)
+        static inline bool _allocate_string(memory_allocator &mem, size_t &size, size_t indent_level, const char *data, size_t data_size)
         {
-          void *d = mem.allocate(indent_level * 2 + data.size());
+          void *d = mem.allocate(indent_level * 2 + data_size);
 
           if (d)
           {
-            size_t i = 0;
-            for (; i < indent_level * 2; ++i) ((char *)d)[i] = ' ';
-
-            memcpy((char *)d + i, data.data(), data.size());
-            size += indent_level * 2 + data.size();
+            memset(d, ' ', indent_level * 2);
+            memcpy((char *)d + indent_level * 2, data, data_size);
+            size += indent_level * 2 + data_size;
             return true;
           }
           return false;
         }
 
+        static inline bool _allocate_string(memory_allocator &mem, size_t &size, size_t indent_level, const std::string &data)
+        {
+          return _allocate_string(mem, size, indent_level, data.data(), data.size());
+        }
+
+        template<size_t Size>
+        static inline bool _allocate_string(memory_allocator &mem, size_t &size, size_t indent_level, const char (&data)[Size])
+        {
+          return _allocate_string(mem, size, indent_level, data, Size - 1);
+        }
+
+        /// \brief allocate \e punctuation ('[', '{' or ','), a new line, \e indent_level levels of indentation and then \e suffix, in a single allocation
+        /// In the compact mode there's no whitespace.
+        template<bool Compact>
+        static inline bool _allocate_opening(memory_allocator &mem, size_t &size, char punctuation, size_t indent_level, const char *suffix = nullptr, size_t suffix_size = 0)
+        {
+          const size_t whitespace = (Compact ? 0 : 1 + indent_level * 2);
+          char *d = reinterpret_cast<char *>(mem.allocate(1 + whitespace + suffix_size));
+          if (!d)
+            return false;
+
+          d[0] = punctuation;
+          if (!Compact)
+          {
+            d[1] = '\n';
+            memset(d + 2, ' ', indent_level * 2);
+          }
+          if (suffix_size)
+            memcpy(d + 1 + whitespace, suffix, suffix_size);
+          size += 1 + whitespace + suffix_size;
+          return true;
+        }
+
+        /// \brief allocate a new line, \e indent_level levels of indentation and then \e punctuation (']' or '}'), in a single allocation
+        /// In the compact mode there's no whitespace.
+        template<bool Compact>
+        static inline bool _allocate_closing(memory_allocator &mem, size_t &size, char punctuation, size_t indent_level)
+        {
+          const size_t whitespace = (Compact ? 0 : 1 + indent_level * 2);
+          char *d = reinterpret_cast<char *>(mem.allocate(whitespace + 1));
+          if (!d)
+            return false;
+
+          if (!Compact)
+          {
+            d[0] = '\n';
+            memset(d + 1, ' ', indent_level * 2);
+          }
+          d[whitespace] = punctuation;
+          size += whitespace + 1;
+          return true;
+        }
+
+        /// \brief allocate [\e data, \e data + \e data_size) escaped and between quotation marks
+        /// (the escaped size is computed first, so that there's a single allocation and no intermediate string)
+        static inline bool _allocate_escaped_string(memory_allocator &mem, size_t &size, const char *data, size_t data_size)
+        {
+          // most strings don't have anything to escape
+          const size_t first_escape = find_escape(data, data_size, 0);
+          const size_t escaped_data_size = (first_escape == data_size ? data_size : first_escape + escaped_size(data + first_escape, data_size - first_escape));
+
+          char *d = reinterpret_cast<char *>(mem.allocate(escaped_data_size + 2));
+          if (!d)
+            return false;
+
+          d[0] = '"';
+          memcpy(d + 1, data, first_escape);
+          escape_to(d + 1 + first_escape, data + first_escape, data_size - first_escape);
+          d[escaped_data_size + 1] = '"';
+          size += escaped_data_size + 2;
+          return true;
+        }
+
+        static inline bool _allocate_format_string(memory_allocator &mem, size_t &size, size_t indent_level, const char *name, const char *data, size_t data_size)
+        {
+          if (!name)
+            return _allocate_string(mem, size, indent_level, data, data_size);
+
+          return _allocate_string(mem, size, indent_level, "")
+                 && _allocate_escaped_string(mem, size, name, strlen(name))
+                 && _allocate_string(mem, size, 0, " : ")
+                 && _allocate_string(mem, size, 0, data, data_size);
+        }
+
         static inline bool _allocate_format_string(memory_allocator &mem, size_t &size, size_t indent_level, const char *name, const std::string &data)
         {
-          std::string res;
-          if (name)
-            res = "\"" + escape_string(name) + "\" : ";
-          res += data;
+          return _allocate_format_string(mem, size, indent_level, name, data.data(), data.size());
+        }
 
-          return _allocate_string(mem, size, indent_level, res);
+        template<size_t Size>
+        static inline bool _allocate_format_string(memory_allocator &mem, size_t &size, size_t indent_level, const char *name, const char (&data)[Size])
+        {
+          return _allocate_format_string(mem, size, indent_level, name, data, Size - 1);
         }
       } // namespace json
     } // namespace internal
@@ -0,0 +1,344 @@
+//
+// file : json_structural_index.hpp
+// in : file:///home/tim/projects/persistence/persistence/json_backend/json_structural_index.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_2420787133906318452_1339226473__JSON_STRUCTURAL_INDEX_HPP__
+# define __N_2420787133906318452_1339226473__JSON_STRUCTURAL_INDEX_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cctype>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+// The first stage of the JSON deserializer: the document is classified 64 bytes at a time (quotes, escapes, brackets)
+// and every string / list / collection is matched with its end, once for the whole document.
+// The deserializers of the nested elements then jump to the end of an element instead of scanning it again.
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      namespace json
+      {
+        /// \brief the position of the end of every string, list and collection of a document
+        class structural_index
+        {
+          public:
+            /// \brief documents smaller than that are simply scanned
+            static constexpr size_t min_document_size = 256;
+
+            /// \brief index a document (see is_valid())
+            structural_index(const char *memory, size_t _size) : base(memory), size(_size)
+            {
+              valid = (size < unmatched) && _build();
+            }
+
+            /// \brief return \b false if the document can't be indexed (it is not well formed)
+            bool is_valid() const
+            {
+              return valid;
+            }
+
+            /// \brief return \b true if \e ptr is in the indexed document
+            bool covers(const char *ptr) const
+            {
+              return valid && ptr >= base && ptr < base + size;
+            }
+
+            /// \brief return the closing character of the string / list / collection that starts at \e ptr
+            /// \return nullptr if \e ptr isn't the start of an element or if it doesn't end in the indexed document
+            const char *get_end(const char *ptr)
+            {
+              if (!covers(ptr))
+                return nullptr;
+              const uint32_t position = static_cast<uint32_t>(ptr - base);
+
+              // the elements are mostly looked up in the order of the document
+              size_t i = hint;
+              if (i >= openers.size() || openers[i] != position)
+              {
+                if (i + 1 < openers.size() && openers[i + 1] == position)
+                  ++i;
+                else
+                {
+                  auto it = std::lower_bound(openers.begin(), openers.end(), position);
+                  if (it == openers.end() || *it != position)
+                    return nullptr;
+                  i = it - openers.begin();
+                }
+              }
+              hint = i;
+              if (closers[i] == unmatched)
+                return nullptr;
+              return base + closers[i];
+            }
+
+            /// \brief return the number of elements of the list / collection that starts at \e ptr (the elements aren't scanned)
+            /// \return \b false if \e ptr isn't the start of a list or a collection that ends in the indexed document
+            bool get_element_count(const char *ptr, size_t &count)
+            {
+              if (!get_end(ptr) || *ptr == '"')
+                return false;
+              count = counts[hint];
+              return true;
+            }
+
+            /// \brief the index of the document being deserialized by the calling thread (nullptr if none)
+            static structural_index *&current()
+            {
+              static thread_local structural_index *index = nullptr;
+              return index;
+            }
+
+          private:
+            enum : uint32_t { unmatched = 0xFFFFFFFF };
+            static constexpr uint64_t even_bits = 0x5555555555555555ull;
+
+            /// \brief the characters of a block of 64 bytes, as bitmasks (bit i is the byte i)
+            struct block_masks
+            {
+              uint64_t quote;
+              uint64_t backslash;
+              uint64_t open;
+              uint64_t close;
+              uint64_t comma;
+            };
+
+            static inline void classify(const char *block, block_masks &masks)
+            {
+#ifdef __SSE2__
+              masks = block_masks {0, 0, 0, 0, 0};
+              const __m128i quote = _mm_set1_epi8('"');
+              const __m128i backslash = _mm_set1_epi8('\\');
+              const __m128i open_bracket = _mm_set1_epi8('[');
+              const __m128i close_bracket = _mm_set1_epi8(']');
+              const __m128i comma = _mm_set1_epi8(',');
+              // '{' and '}' are '[' and ']' + 0x20
+              const __m128i case_bit = _mm_set1_epi8(0x20);
+              for (size_t i = 0; i < 4; ++i)
+              {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i * 16));
+                const __m128i folded = _mm_andnot_si128(case_bit, chunk);
+                const unsigned shift = i * 16;
+                masks.quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)))) << shift;
+                masks.backslash |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash)))) << shift;
+                masks.open |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(folded, open_bracket)))) << shift;
+                masks.close |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(folded, close_bracket)))) << shift;
+                masks.comma |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, comma)))) << shift;
+              }
+#else
+              masks = block_masks {0, 0, 0, 0, 0};
+              for (size_t i = 0; i < 64; ++i)
+              {
+                const uint64_t bit = uint64_t(1) << i;
+                switch (block[i])
+                {
+                  case '"': masks.quote |= bit; break;
+                  case '\\': masks.backslash |= bit; break;
+                  case '[': case '{': masks.open |= bit; break;
+                  case ']': case '}': masks.close |= bit; break;
+                  case ',': masks.comma |= bit; break;
+                }
+              }
+#endif
+            }
+
+            /// \brief return the characters that are escaped (preceded by an odd number of backslashes)
+            static inline uint64_t get_escaped(uint64_t backslash, uint64_t &prev_ends_odd_backslash)
+            {
+              const uint64_t start_edges = backslash & ~(backslash << 1);
+              const uint64_t even_start_mask = even_bits ^ prev_ends_odd_backslash;
+              const uint64_t even_starts = start_edges & even_start_mask;
+              const uint64_t odd_starts = start_edges & ~even_start_mask;
+              const uint64_t even_carries = backslash + even_starts;
+              uint64_t odd_carries = backslash + odd_starts;
+              const bool ends_odd_backslash = (odd_carries < backslash);
+              odd_carries |= prev_ends_odd_backslash;
+              prev_ends_odd_backslash = ends_odd_backslash ? 1 : 0;
+
+              const uint64_t even_carry_ends = even_carries & ~backslash;
+              const uint64_t odd_carry_ends = odd_carries & ~backslash;
+              return (even_carry_ends & ~even_bits) | (odd_carry_ends & even_bits);
+            }
+
+            /// \brief bit i is set if there's an odd number of bits set in [0, i]
+            static inline uint64_t prefix_xor(uint64_t bits)
+            {
+              bits ^= bits << 1;
+              bits ^= bits << 2;
+              bits ^= bits << 4;
+              bits ^= bits << 8;
+              bits ^= bits << 16;
+              bits ^= bits << 32;
+              return bits;
+            }
+
+            static inline unsigned lowest_bit(uint64_t bits)
+            {
+#if defined(__GNUC__) || defined(__clang__)
+              return __builtin_ctzll(bits);
+#else
+              unsigned i = 0;
+              for (; !(bits & 1); bits >>= 1)
+                ++i;
+              return i;
+#endif
+            }
+
+            bool _build()
+            {
+              uint64_t prev_ends_odd_backslash = 0;
+              uint64_t prev_in_string = 0;
+              std::vector<uint32_t> stack;
+              size_t string_opener = 0;
+
+              char tail[64];
+              for (size_t offset = 0; offset < size; offset += 64)
+              {
+                const char *block = base + offset;
+                if (size - offset < 64)
+                {
+                  memset(tail, ' ', sizeof(tail));
+                  memcpy(tail, block, size - offset);
+                  block = tail;
+                }
+
+                block_masks masks;
+                classify(block, masks);
+
+                const uint64_t quotes = masks.quote & ~get_escaped(masks.backslash, prev_ends_odd_backslash);
+                const uint64_t in_string = prefix_xor(quotes) ^ prev_in_string; // (the opening quote is in the string, the closing one isn't)
+                prev_in_string = uint64_t(int64_t(in_string) >> 63);
+
+                // walk the structural characters in the order of the document
+                uint64_t structurals = quotes | ((masks.open | masks.close | masks.comma) & ~in_string);
+                while (structurals)
+                {
+                  const unsigned bit = lowest_bit(structurals);
+                  structurals &= structurals - 1;
+                  const uint32_t position = static_cast<uint32_t>(offset + bit);
+
+                  if ((quotes >> bit) & 1)
+                  {
+                    if ((in_string >> bit) & 1)
+                    {
+                      string_opener = openers.size();
+                      openers.push_back(position);
+                      closers.push_back(unmatched);
+                      counts.push_back(0);
+                    }
+                    else
+                      closers[string_opener] = position;
+                  }
+                  else if ((masks.comma >> bit) & 1)
+                  {
+                    if (!stack.empty())
+                      ++counts[stack.back()];
+                  }
+                  else if ((masks.open >> bit) & 1)
+                  {
+                    stack.push_back(static_cast<uint32_t>(openers.size()));
+                    openers.push_back(position);
+                    closers.push_back(unmatched);
+                    counts.push_back(0); // (the commas, until the element is closed)
+                  }
+                  else
+                  {
+                    // a closing bracket without its opening one, or a ']' that closes a '{' (or the opposite)
+                    if (stack.empty() || (base[openers[stack.back()]] ^ base[position]) != ('[' ^ ']'))
+                      return false;
+                    closers[stack.back()] = position;
+
+                    // the elements are the commas + 1, unless the list / collection is empty
+                    uint32_t &count = counts[stack.back()];
+                    if (!count)
+                    {
+                      size_t i = openers[stack.back()] + 1;
+                      while (i < position && std::isspace(static_cast<unsigned char>(base[i])))
+                        ++i;
+                      count = (i < position ? 1 : 0);
+                    }
+                    else
+                      ++count;
+                    stack.pop_back();
+                  }
+                }
+              }
+              return true;
+            }
+
+          private:
+            const char *base;
+            size_t size;
+            bool valid;
+            size_t hint = 0;
+            std::vector<uint32_t> openers; ///< position of every '"', '[' and '{' that starts an element (sorted)
+            std::vector<uint32_t> closers; ///< position of their closing character (or unmatched)
+            std::vector<uint32_t> counts;  ///< number of elements of the lists / collections
+        };
+
+        /// \brief make sure that the document that contains [\e memory, \e memory + \e size) is indexed while the scope is alive
+        /// The first scope of a document (the outermost element) indexes it, the nested ones use that index.
+        class structural_scope
+        {
+          public:
+            structural_scope(const char *memory, size_t size) : previous(structural_index::current())
+            {
+              if ((previous && previous->covers(memory)) || size < structural_index::min_document_size)
+                return;
+              index.reset(new structural_index(memory, size));
+              if (index->is_valid())
+                structural_index::current() = index.get();
+            }
+
+            ~structural_scope()
+            {
+              structural_index::current() = previous;
+            }
+
+            structural_scope(const structural_scope &) = delete;
+            structural_scope &operator = (const structural_scope &) = delete;
+
+          private:
+            structural_index *previous;
+            std::unique_ptr<structural_index> index;
+        };
+      } // namespace json
+    } // namespace internal
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_2420787133906318452_1339226473__JSON_STRUCTURAL_INDEX_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
@@ -32,22 +32,22 @@
 
 #include <type_traits>
 #include <string>
-#include <sstream>
-#include <iomanip>
+#include <new>
 #include "../tools/array_wrapper.hpp"
 #include "../tools/demangle.hpp"
 #include "../object.hpp" // for my IDE
 #include "../raw_data.hpp"
 
 #include "serializable_specs_json_internal.hpp"
+#include "json_parallel_writer.hpp"
 
 namespace neam
 {
   namespace cr
   {
     /// \brief Pointer serializer
-    template<typename Type>
-    class persistence::serializable<persistence_backend::json, Type *, typename std::enable_if<!std::is_same<Type, char>::value && !std::is_same<Type, const char>::value, void>::type>
+    template<bool Compact, typename Type>
+    class persistence::serializable<persistence_backend::basic_json<Compact>, Type *, typename std::enable_if<!std::is_same<Type, char>::value && !std::is_same<Type, const char>::value, void>::type>
     {
       public:
         /// \brief deserialize the object
@@ -69,7 +69,7 @@ namespace neam
           if (!tptr)
             return false;
           *ptr = tptr;
-          return serializable<persistence_backend::json, Type>::from_memory(transaction, memory, size, tptr, std::forward<Params>(p)...);
+          return serializable<persistence_backend::basic_json<Compact>, Type>::from_memory(transaction, memory, size, tptr, std::forward<Params>(p)...);
         }
 
         /// \brief The default initializer, if nothing is provided to initialize this field in the JSON
@@ -89,13 +89,13 @@ namespace neam
           // handle the null pointer case
           if (!*ptr)
             return internal::json::_allocate_format_string(mem, size, 0, nullptr, "null");
-          return serializable<persistence_backend::json, Type>::to_memory(mem, size, *ptr, indent);
+          return serializable<persistence_backend::basic_json<Compact>, Type>::to_memory(mem, size, *ptr, indent);
         }
     };
 
     /// \brief boolean serializer
-    template<>
-    class persistence::serializable<persistence_backend::json, bool>
+    template<bool Compact>
+    class persistence::serializable<persistence_backend::basic_json<Compact>, bool>
     {
       public:
         /// \brief The default initializer, if nothing is provided to initialize this field in the JSON
@@ -146,8 +146,8 @@ namespace neam
     };
 
     /// \brief the default serializer for numeric types
-    template<typename Type>
-    class persistence::serializable<persistence_backend::json, Type, internal::numeric>
+    template<bool Compact, typename Type>
+    class persistence::serializable<persistence_backend::basic_json<Compact>, Type, internal::numeric>
     {
       static_assert(std::is_arithmetic<Type>::value, "only arithmetic types here !!!");
       public:
@@ -163,12 +163,12 @@ namespace neam
         /// \param[in] size the size of the memory area
         /// \param[out] ptr a pointer to the object (the one that the function will fill)
         /// \return true if successful
-        static inline bool from_memory(cr::allocation_transaction &, const char *memory, size_t, Type *ptr)
+        static inline bool from_memory(cr::allocation_transaction &, const char *memory, size_t size, Type *ptr)
         {
           internal::json::types type = internal::json::get_type(memory[0]);
           if (type != internal::json::types::number)
             return false;
-          return internal::json::number_from_string(memory, *ptr);
+          return internal::json::number_from_string(memory, size, *ptr);
         }
 
         /// \brief serialize the object
@@ -178,34 +178,32 @@ namespace neam
         /// \return true if successful
         static bool to_memory(memory_allocator &mem, size_t &size, const Type *ptr, size_t = 0)
         {
-          std::ostringstream os;
-          if (std::is_floating_point<Type>::value && std::numeric_limits<Type>::max_digits10 > 0)
-            os << std::setprecision(std::numeric_limits<Type>::max_digits10);
-          os << (*ptr);
-          return internal::json::_allocate_format_string(mem, size, 0, nullptr, os.str());
+          char buffer[internal::json::max_number_length];
+          const size_t length = internal::json::number_to_string(*ptr, buffer);
+          return internal::json::_allocate_string(mem, size, 0, buffer, length);
         }
     };
 
     // for arithmetic types
-    template<> class persistence::serializable<persistence_backend::json, char> : public persistence::serializable<persistence_backend::json, char, internal::numeric> {};
-    template<> class persistence::serializable<persistence_backend::json, unsigned char> : public persistence::serializable<persistence_backend::json, unsigned char, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, char> : public persistence::serializable<persistence_backend::basic_json<Compact>, char, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, unsigned char> : public persistence::serializable<persistence_backend::basic_json<Compact>, unsigned char, internal::numeric> {};
 
-    template<> class persistence::serializable<persistence_backend::json, short> : public persistence::serializable<persistence_backend::json, short, internal::numeric> {};
-    template<> class persistence::serializable<persistence_backend::json, unsigned short> : public persistence::serializable<persistence_backend::json, unsigned short, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, short> : public persistence::serializable<persistence_backend::basic_json<Compact>, short, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, unsigned short> : public persistence::serializable<persistence_backend::basic_json<Compact>, unsigned short, internal::numeric> {};
 
-    template<> class persistence::serializable<persistence_backend::json, int> : public persistence::serializable<persistence_backend::json, int, internal::numeric> {};
-    template<> class persistence::serializable<persistence_backend::json, unsigned int> : public persistence::serializable<persistence_backend::json, unsigned int, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, int> : public persistence::serializable<persistence_backend::basic_json<Compact>, int, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, unsigned int> : public persistence::serializable<persistence_backend::basic_json<Compact>, unsigned int, internal::numeric> {};
 
-    template<> class persistence::serializable<persistence_backend::json, long> : public persistence::serializable<persistence_backend::json, long, internal::numeric> {};
-    template<> class persistence::serializable<persistence_backend::json, unsigned long> : public persistence::serializable<persistence_backend::json, unsigned long, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, long> : public persistence::serializable<persistence_backend::basic_json<Compact>, long, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, unsigned long> : public persistence::serializable<persistence_backend::basic_json<Compact>, unsigned long, internal::numeric> {};
 
-    template<> class persistence::serializable<persistence_backend::json, float> : public persistence::serializable<persistence_backend::json, float, internal::numeric> {};
-    template<> class persistence::serializable<persistence_backend::json, double> : public persistence::serializable<persistence_backend::json, double, internal::numeric> {};
-    template<> class persistence::serializable<persistence_backend::json, long double> : public persistence::serializable<persistence_backend::json, long double, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, float> : public persistence::serializable<persistence_backend::basic_json<Compact>, float, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, double> : public persistence::serializable<persistence_backend::basic_json<Compact>, double, internal::numeric> {};
+    template<bool Compact> class persistence::serializable<persistence_backend::basic_json<Compact>, long double> : public persistence::serializable<persistence_backend::basic_json<Compact>, long double, internal::numeric> {};
 
     /// \brief a special case for C strings
-    template<>
-    class persistence::serializable<persistence_backend::json, char *>
+    template<bool Compact>
+    class persistence::serializable<persistence_backend::basic_json<Compact>, char *>
     {
       public:
         /// \brief The default initializer, if nothing is provided to initialize this field in the JSON
@@ -233,16 +231,15 @@ namespace neam
           if (type != internal::json::types::string)
             return false;
 
-          std::string un = internal::json::unescape_string(memory + 1, size - 1);
-
-          // We have to remove the two quotation marks from the memory area
-          *ptr = reinterpret_cast<char *>(transaction.allocate_raw(un.size() + 1));
-          if (*ptr)
-          {
-            memcpy(*ptr, un.data(), un.size());
-            (*ptr)[un.size()] = 0;
-          }
-          return !!*ptr;
+          // the string is unescaped directly in its destination (the unescaped string is never longer)
+          *ptr = reinterpret_cast<char *>(transaction.allocate_raw(size));
+          if (!*ptr)
+            return false;
+          size_t str_size = 0;
+          if (!internal::json::unescape_to(*ptr, str_size, memory + 1, size - 1))
+            return false;
+          (*ptr)[str_size] = 0;
+          return true;
         }
 
         /// \brief serialize the object
@@ -255,12 +252,102 @@ namespace neam
         {
           if (!*ptr)
             return internal::json::_allocate_format_string(mem, size, 0, nullptr, "null");
-          return internal::json::_allocate_format_string(mem, size, 0, nullptr, "\"" + internal::json::escape_string(*ptr) + "\"");
+          return internal::json::_allocate_escaped_string(mem, size, *ptr, strlen(*ptr));
         }
     };
 
-    template<>
-    class persistence::serializable<persistence_backend::json, raw_data>
+    /// \brief a special case for std::strings: they are unescaped directly in their own buffer
+    /// (instead of going through a temporary C string like the generic serializer in stl/string.hpp)
+    template<bool Compact, typename Traits, typename Alloc>
+    class persistence::serializable<persistence_backend::basic_json<Compact>, std::basic_string<char, Traits, Alloc>>
+    {
+      public:
+        /// \brief The default initializer, if nothing is provided to initialize this field in the JSON
+        static inline bool default_initializer(cr::allocation_transaction &transaction, std::basic_string<char, Traits, Alloc> *ptr)
+        {
+          new(ptr) std::basic_string<char, Traits, Alloc>();
+          transaction.register_destructor_call_on_failure(ptr);
+          return true;
+        }
+
+        /// \brief deserialize the object
+        /// \param[in] memory the serialized object
+        /// \param[in] size the size of the memory area
+        /// \param[out] ptr a pointer to the object (the one that the function will fill)
+        /// \return true if successful
+        template<typename... Params>
+        static inline bool from_memory(cr::allocation_transaction &transaction, const char *memory, size_t size, std::basic_string<char, Traits, Alloc> *ptr, Params &&...)
+        {
+          internal::json::types type = internal::json::get_type(memory[0]);
+          if (type == internal::json::types::other && size == 4 && memcmp(memory, "null", 4) == 0)
+            return default_initializer(transaction, ptr);
+          if (type != internal::json::types::string)
+            return false;
+
+          ++memory; // skip the opening quotation mark
+          --size;
+
+          // most strings don't have any escape sequence: they are constructed directly from the serialized data
+          const size_t first_unescape = internal::json::find_unescape(memory, size, 0);
+          if (first_unescape == size || memory[first_unescape] == '"')
+          {
+            new(ptr) std::basic_string<char, Traits, Alloc>(memory, first_unescape);
+            transaction.register_destructor_call_on_failure(ptr);
+            return true;
+          }
+
+          // the unescaped string is never longer than the escaped one
+          new(ptr) std::basic_string<char, Traits, Alloc>(size, '\0');
+          transaction.register_destructor_call_on_failure(ptr);
+          size_t str_size = 0;
+          if (!internal::json::unescape_to(&(*ptr)[0], str_size, memory, size))
+            return false;
+          ptr->resize(str_size);
+          return true;
+        }
+
+        /// \brief serialize the object
+        /// \param[out] memory the serialized object (don't forget to \b free that memory !!!)
+        /// \param[out] size the size of the memory area
+        /// \param[in] ptr a pointer to the object (the one that the function will serialize)
+        /// \return true if successful
+        template<typename... Params>
+        static inline bool to_memory(memory_allocator &mem, size_t &size, const std::basic_string<char, Traits, Alloc> *ptr, Params &&...)
+        {
+          return internal::json::_allocate_escaped_string(mem, size, ptr->data(), ptr->size());
+        }
+    };
+
+    /// \brief object member names are compared to the serialized keys in place (they are only unescaped when they have to)
+    template<bool Compact>
+    struct persistence::key_reader<persistence_backend::basic_json<Compact>>
+    {
+      template<typename Func, typename... Params>
+      static inline bool read(const char *memory, size_t size, Func &&func, Params && ...)
+      {
+        if (internal::json::get_type(memory[0]) != internal::json::types::string)
+          return false;
+        ++memory; // skip the opening quotation mark
+        --size;
+
+        const size_t first_unescape = internal::json::find_unescape(memory, size, 0);
+        if (first_unescape == size || memory[first_unescape] == '"')
+        {
+          func(memory, first_unescape);
+          return true;
+        }
+
+        std::string key(size, '\0');
+        size_t key_size = 0;
+        if (!internal::json::unescape_to(&key[0], key_size, memory, size))
+          return false;
+        func(const_cast<const char *>(key.data()), key_size);
+        return true;
+      }
+    };
+
+    template<bool Compact>
+    class persistence::serializable<persistence_backend::basic_json<Compact>, raw_data>
     {
       public:
         /// \brief The default initializer, if nothing is provided to initialize this field in the JSON
@@ -292,54 +379,17 @@ namespace neam
           ++memory;
 
           // We have to remove the two quotation marks from the memory area
-          uint8_t *data = reinterpret_cast<uint8_t *>(transaction.allocate_raw(size - 1));
-          if (data)
-          {
-            // unescape the string
-            size_t i = 0;
-            size_t shift = 0;
-            for (; i + shift < size - 1; ++i)
-            {
-              if (memory[i + shift] == '\\')
-              {
-                ++shift;
-                if (i + shift >= size - 1)
-                  return false;
-                switch (memory[i + shift])
-                {
-                  case '\\':
-                  case '"': data[i] = memory[i + shift]; break;
-                  case 'n': data[i] = '\n'; break;
-                  case 't': data[i] = '\t'; break;
-                  case 'b': data[i] = '\b'; break;
-                  case 'r': data[i] = '\r'; break;
-                  case 'f': data[i] = '\f'; break;
-                  case 'u': // convert the following 4 [0-9A-F] code to binary data
-                    ++shift;
-                    if (i + shift + 3 >= size - 1)
-                      return false;
-                    char sdata[] = {memory[i + shift + 0], memory[i + shift + 1], memory[i + shift + 2], memory[i + shift + 3], 0};
-                    shift += 3;
-                    char *_u = sdata;
-                    uint16_t t = strtoul(sdata, &_u, 16);
-                    if (t & 0xFF00)
-                    {
-                      data[i++] = t >> 8;
-                      --shift; // compensate the incrementation of i
-                    }
-                    data[i] = t & 0xFF;
-                }
-              }
-              else
-                data[i] = memory[i + shift];
-            }
-            ptr->data = reinterpret_cast<int8_t *>(data);
-            ptr->size = i;
-            ptr->ownership = true;
-            // WE DON'T REGISTER THE DESTRUCTOR IN THE TRANSACTION: WE ALREADY HAVE THE MEMORY REGISTERED TO BE DELETED
-            return true;
-          }
-          return false;
+          int8_t *data = reinterpret_cast<int8_t *>(transaction.allocate_raw(size - 1));
+          if (!data)
+            return false;
+          size_t data_size = 0;
+          if (!internal::json::unescape_to(reinterpret_cast<char *>(data), data_size, memory, size - 1))
+            return false;
+          ptr->data = data;
+          ptr->size = data_size;
+          ptr->ownership = true;
+          // WE DON'T REGISTER THE DESTRUCTOR IN THE TRANSACTION: WE ALREADY HAVE THE MEMORY REGISTERED TO BE DELETED
+          return true;
         }
 
         /// \brief serialize the object
@@ -351,44 +401,15 @@ namespace neam
         {
           if (!ptr->data)
             return internal::json::_allocate_format_string(mem, size, 0, nullptr, "null");
-          std::string data;
-          data.reserve(ptr->size * 8 + 2);
-          data += "\"";
-          for (size_t i = 0; i < ptr->size; ++i)
-          {
-            if (((std::isgraph(ptr->data[i]) || ptr->data[i] > ' ') && ptr->data[i] != '"' && ptr->data[i] != '\\') || ptr->data[i] == ' ')
-              data += ptr->data[i];
-            else if(ptr->data[i] != '"' && ptr->data[i] != '\\')
-            {
-              switch (ptr->data[i])
-              {
-                case '\b': data += "\\b"; break;
-                case '\f': data += "\\f"; break;
-                case '\n': data += "\\n"; break;
-                case '\r': data += "\\r"; break;
-                case '\t': data += "\\t"; break;
-                default:
-                  data += "\\u00";
-                  data += internal::json::hex_alphabet[(ptr->data[i] & 0xF0) >> 4];
-                  data += internal::json::hex_alphabet[ptr->data[i] & 0x0F];
-              }
-            }
-            else
-            {
-              data += "\\";
-              data += ptr->data[i];
-            }
-          }
-          data += "\"";
-          return internal::json::_allocate_format_string(mem, size, 0, nullptr, data);
+          return internal::json::_allocate_escaped_string(mem, size, reinterpret_cast<const char *>(ptr->data), ptr->size);
         }
     };
 
     /// \brief Helper to [de]serialize list-like objects
     namespace persistence_helper
     {
-      template<typename Type, typename Caller, serializable_mode Mode>
-      class list_serializable<persistence_backend::json, Type, Caller, Mode>
+      template<bool Compact, typename Type, typename Caller, serializable_mode Mode>
+      class list_serializable<persistence_backend::basic_json<Compact>, Type, Caller, Mode>
       {
         public:
           /// \brief Called to deserialize the list-object
@@ -403,6 +424,10 @@ namespace neam
             if (type != internal::json::types::list)
               return false;
 
+            // (the whole document is indexed once, by its outermost element)
+            internal::json::structural_scope structure(memory, size);
+            const char *list_start = memory;
+
             ++memory; // skip the opening bracket
             --size;
 
@@ -412,7 +437,11 @@ namespace neam
             size_t index = 0;
             if (!std::isspace(memory[0]) || internal::json::advance_next(memory, size, index))
             {
-              const size_t element_count = get_slot_count(memory + index, size);
+              // the index of the document has already counted the elements
+              size_t element_count = 0;
+              internal::json::structural_index *index_ptr = internal::json::structural_index::current();
+              if ((!index_ptr || !index_ptr->get_element_count(list_start, element_count)) && !get_slot_count(memory + index, size - index, element_count))
+                return false;
               if (element_count)
               {
                 if (!Caller::from_memory_allocate(transaction, element_count, ptr))
@@ -423,6 +452,9 @@ namespace neam
                   size_t element_index = 0;
                   while (true)
                   {
+                    if (element_index >= element_count) // the JSON is not well formatted
+                      return false;
+
                     size_t end_index = index;
 
                     internal::json::types elem_type = internal::json::get_type(memory[index]);
@@ -436,9 +468,14 @@ namespace neam
                     index = end_index;
                     ++element_index;
 
-                    if (!internal::json::advance_next(memory, size, index, ','))
+                    bool last = false;
+                    if (!internal::json::next_element(memory, size, index, elem_type, ']', last)) // (two elements without a comma)
+                      return false;
+                    if (last)
                       break; // can't do much more
                   }
+                  if (element_index != element_count) // (a trailing comma)
+                    return false;
                 }
               }
               else
@@ -455,32 +492,39 @@ namespace neam
             const size_t element_count = Caller::to_memory_get_element_count(ptr);
             auto iterator = Caller::to_memory_get_iterator(ptr);
 
-            if (!internal::json::_allocate_string(mem, whole_object_size, 0, "[\n"))
+            if (!element_count && !internal::json::_allocate_opening<Compact>(mem, whole_object_size, '[', 0))
               return false;
 
-            for (size_t index = 0; index < element_count; ++index)
+            auto write_element = [ptr, indent_level](memory_allocator &element_mem, size_t &element_size, decltype(iterator) &it, size_t index) -> bool
             {
-              if (index > 0)
-              {
-                if (!internal::json::_allocate_string(mem, whole_object_size, 0, ",\n"))
-                  return false;
-              }
-              if (!internal::json::_allocate_string(mem, whole_object_size, indent_level + 1, ""))
+              if (!internal::json::_allocate_opening<Compact>(element_mem, element_size, (index ? ',' : '['), indent_level + 1))
                 return false;
-
-              size_t element_size = 0;
-              if (!Caller::to_memory_single(mem, element_size, iterator, ptr, indent_level + 1))
+              size_t sz = 0;
+              if (!Caller::to_memory_single(element_mem, sz, it, ptr, indent_level + 1))
                 return false;
-              whole_object_size += element_size;
-              if (!Caller::to_memory_increment_iterator(iterator))
+              element_size += sz;
+              return true;
+            };
+            auto increment = [](decltype(iterator) &it) -> bool { return Caller::to_memory_increment_iterator(it); };
+
+            // big lists are written by all the cores (the output stays the same)
+            if (internal::json::parallel_writer::should_split(element_count))
+            {
+              if (!internal::json::parallel_writer::write(mem, whole_object_size, element_count, iterator, write_element, increment))
                 return false;
             }
+            else
+            {
+              for (size_t index = 0; index < element_count; ++index)
+              {
+                if (!write_element(mem, whole_object_size, iterator, index) || !increment(iterator))
+                  return false;
+              }
+            }
             if (!Caller::to_memory_end_iterator(iterator))
               return false;
 
-            if (!internal::json::_allocate_string(mem, whole_object_size, 0, "\n"))
-              return false;
-            if (!internal::json::_allocate_string(mem, whole_object_size, indent_level, "]"))
+            if (!internal::json::_allocate_closing<Compact>(mem, whole_object_size, ']', indent_level))
               return false;
 
             size = whole_object_size;
@@ -489,10 +533,11 @@ namespace neam
           }
 
         private:
-          /// \todo find something better than this slow thing
-          static inline size_t get_slot_count(const char *memory, size_t size)
+          /// \brief count the elements by scanning them (for documents that aren't indexed)
+          /// \return false if the list is not well formatted (an element that doesn't end, a trailing comma)
+          static inline bool get_slot_count(const char *memory, size_t size, size_t &count)
           {
-            size_t count = 0;
+            count = 0;
             size_t index = 0;
             while (true)
             {
@@ -502,38 +547,43 @@ namespace neam
               internal::json::types elem_type = internal::json::get_type(memory[index]);
               end_index = index;
               if (!internal::json::get_element_end_index(memory, size, end_index, elem_type))
-                return 0;
+                return !count && memory[index] == ']'; // (an empty list, there must be an element after a comma)
               ++count;
               index = end_index;
 
-              if (!internal::json::advance_next(memory, size, index, ','))
-                break; // can't do much more
+              // only the closing bracket can be left after the last element (not a trailing comma, nor another element)
+              bool last = false;
+              if (!internal::json::next_element(memory, size, index, elem_type, ']', last))
+                return false;
+              if (last)
+                return true;
             }
-            return count;
           }
       };
 
-      template<> struct should_be_serialized_as_collection<persistence_backend::json, const char *> : public std::true_type {};
-      template<> struct should_be_serialized_as_collection<persistence_backend::json, char *> : public std::true_type {};
-      template<> struct should_be_serialized_as_collection<persistence_backend::json, char *const> : public std::true_type {};
-      template<> struct should_be_serialized_as_collection<persistence_backend::json, const char *const> : public std::true_type {};
-      template<typename CharT, typename Traits, typename Alloc> struct should_be_serialized_as_collection<persistence_backend::json, std::basic_string<CharT, Traits, Alloc>> : public std::true_type {};
-      template<typename CharT, typename Traits, typename Alloc> struct should_be_serialized_as_collection<persistence_backend::json, const std::basic_string<CharT, Traits, Alloc>> : public std::true_type {};
+      template<bool Compact> struct should_be_serialized_as_collection<persistence_backend::basic_json<Compact>, const char *> : public std::true_type {};
+      template<bool Compact> struct should_be_serialized_as_collection<persistence_backend::basic_json<Compact>, char *> : public std::true_type {};
+      template<bool Compact> struct should_be_serialized_as_collection<persistence_backend::basic_json<Compact>, char *const> : public std::true_type {};
+      template<bool Compact> struct should_be_serialized_as_collection<persistence_backend::basic_json<Compact>, const char *const> : public std::true_type {};
+      template<bool Compact, typename CharT, typename Traits, typename Alloc> struct should_be_serialized_as_collection<persistence_backend::basic_json<Compact>, std::basic_string<CharT, Traits, Alloc>> : public std::true_type {};
+      template<bool Compact, typename CharT, typename Traits, typename Alloc> struct should_be_serialized_as_collection<persistence_backend::basic_json<Compact>, const std::basic_string<CharT, Traits, Alloc>> : public std::true_type {};
 
       /// \brief Helper to [de]serialize collection-like objects
       /// In this backend, this is exactly as the list serializer. (code re-use ftw).
-      template<typename Type, typename Caller, serializable_mode Mode>
-      class collection_serializable<persistence_backend::json, Type, Caller, Mode>
+      template<bool Compact, typename Type, typename Caller, serializable_mode Mode>
+      class collection_serializable<persistence_backend::basic_json<Compact>, Type, Caller, Mode>
       {
         public:
           static inline bool from_memory(allocation_transaction &transaction, const char *memory, size_t size, Type *ptr)
           {
             internal::json::types type = internal::json::get_type(memory[0]);
             if (type == internal::json::types::list)
-              return list_serializable<persistence_backend::json, Type, Caller, Mode>::from_memory(transaction, memory, size, ptr);
+              return list_serializable<persistence_backend::basic_json<Compact>, Type, Caller, Mode>::from_memory(transaction, memory, size, ptr);
             if (type != internal::json::types::collection)
               return false;
 
+            internal::json::structural_scope structure(memory, size);
+
             --size;   // skip the closing brace
             ++memory; // skip the opening brace
 
@@ -560,33 +610,42 @@ namespace neam
                 allocation_transaction temp_transaction;
                 allocation_transaction *transaction_ptr = (Caller::can_construct_inplace ? &transaction : &temp_transaction);
 
-                // get the key (must be a string)
-                if (!Caller::from_memory_single_key(*transaction_ptr, ptr, temp_memory_ptr, memory + index, end_index - index))
-                  return false;
-
-                // skip the : token
-                index = end_index;
-                if (!internal::json::advance_next(memory, size, index, ':'))
-                  return false;
-
-                // chain unserialize
-                internal::json::types elem_type = internal::json::get_type(memory[index]);
-                end_index = index;
-                if (!internal::json::get_element_end_index(memory, size, end_index, elem_type))
-                  return false;
-
-                // get the value
-                if (!Caller::from_memory_single_value(*transaction_ptr, ptr, temp_memory_ptr, memory + index, end_index - index))
+                internal::json::types elem_type = internal::json::types::bad_type;
+                auto read_member = [&]() -> bool
+                {
+                  // get the key (must be a string)
+                  if (!Caller::from_memory_single_key(*transaction_ptr, ptr, temp_memory_ptr, memory + index, end_index - index))
+                    return false;
+
+                  // skip the : token
+                  index = end_index;
+                  if (!internal::json::skip_key_separator(memory, size, index))
+                    return false;
+
+                  // chain unserialize
+                  elem_type = internal::json::get_type(memory[index]);
+                  end_index = index;
+                  if (!internal::json::get_element_end_index(memory, size, end_index, elem_type))
+                    return false;
+
+                  // get the value
+                  if (!Caller::from_memory_single_value(*transaction_ptr, ptr, temp_memory_ptr, memory + index, end_index - index))
+                    return false;
+                  index = end_index;
+
+                  return Caller::from_memory_single_push_kv(transaction, ptr, temp_memory_ptr);
+                };
+                const bool res = read_member();
+
+                // call the destructor of the temporary memory (of a member that failed to be read too)
+                temp_transaction.rollback();
+                if (!res)
                   return false;
-                index = end_index;
 
-                if (!Caller::from_memory_single_push_kv(transaction, ptr, temp_memory_ptr))
+                bool last = false;
+                if (!internal::json::next_element(memory, size, index, elem_type, '}', last)) // (two members without a comma)
                   return false;
-
-                // call the destructor of the temporary memory
-                temp_transaction.rollback();
-
-                if (!internal::json::advance_next(memory, size, index, ','))
+                if (last)
                   break; // can't do much more
               }
             }
@@ -596,51 +655,56 @@ namespace neam
           static inline bool to_memory(NCR_ENABLE_IF(!(Mode & to_memory_compiletime), memory_allocator) &mem, size_t &size, const Type *ptr, size_t indent_level = 0)
           {
             if (!Caller::should_be_serialized_as_collection)
-              return list_serializable<persistence_backend::json, Type, Caller, Mode>::to_memory(mem, size, ptr, indent_level);
+              return list_serializable<persistence_backend::basic_json<Compact>, Type, Caller, Mode>::to_memory(mem, size, ptr, indent_level);
 
             size_t whole_object_size = 0;
 
-            if (!internal::json::_allocate_string(mem, whole_object_size, 0, "{\n"))
-              return false;
-
             const size_t element_count = Caller::to_memory_get_element_count(ptr);
             auto it = Caller::to_memory_get_iterator(ptr);
 
-            bool first = true;
-            for (size_t i = 0; i < element_count; ++i)
+            if (!element_count && !internal::json::_allocate_opening<Compact>(mem, whole_object_size, '{', 0))
+              return false;
+
+            auto write_element = [ptr, indent_level](memory_allocator &element_mem, size_t &element_size, decltype(it) &element_it, size_t index) -> bool
             {
-              if (!first)
-              {
-                if (!internal::json::_allocate_string(mem, whole_object_size, 0, ",\n"))
-                  return false;
-              }
-              if (!internal::json::_allocate_string(mem, whole_object_size, indent_level + 1, ""))
+              if (!internal::json::_allocate_opening<Compact>(element_mem, element_size, (index ? ',' : '{'), indent_level + 1))
                 return false;
               size_t sz = 0;
-              if (!Caller::to_memory_single_key(mem, sz, it, ptr, indent_level + 1))
+              if (!Caller::to_memory_single_key(element_mem, sz, element_it, ptr, indent_level + 1))
                 return false;
 
-              whole_object_size += sz;
+              element_size += sz;
 
-              if (!internal::json::_allocate_string(mem, whole_object_size, 0, ":"))
+              if (!internal::json::_allocate_string(element_mem, element_size, 0, ":"))
                 return false;
 
               sz = 0;
 
-              if (!Caller::to_memory_single_value(mem, sz, it, ptr, indent_level + 1))
+              if (!Caller::to_memory_single_value(element_mem, sz, element_it, ptr, indent_level + 1))
                 return false;
 
-              whole_object_size += sz;
-              first = false;
+              element_size += sz;
+              return true;
+            };
+            auto increment = [](decltype(it) &element_it) -> bool { return Caller::to_memory_increment_iterator(element_it); };
 
-              if (!Caller::to_memory_increment_iterator(it))
+            // big collections are written by all the cores (the output stays the same)
+            if (internal::json::parallel_writer::should_split(element_count))
+            {
+              if (!internal::json::parallel_writer::write(mem, whole_object_size, element_count, it, write_element, increment))
                 return false;
             }
+            else
+            {
+              for (size_t i = 0; i < element_count; ++i)
+              {
+                if (!write_element(mem, whole_object_size, it, i) || !increment(it))
+                  return false;
+              }
+            }
             if (!Caller::to_memory_end_iterator(it))
               return false;
-            if (!internal::json::_allocate_string(mem, whole_object_size, 0, "\n"))
-              return false;
-            if (!internal::json::_allocate_string(mem, whole_object_size, indent_level, "}"))
+            if (!internal::json::_allocate_closing<Compact>(mem, whole_object_size, '}', indent_level))
               return false;
             size = whole_object_size;
             return true;
@@ -650,21 +714,18 @@ namespace neam
           static inline bool to_memory(NCR_ENABLE_IF((Mode & to_memory_compiletime) != 0, memory_allocator) &mem, size_t &size, const Type *ptr, size_t indent_level = 0)
           {
             if (!Caller::should_be_serialized_as_collection)
-              return list_serializable<persistence_backend::json, Type, Caller, Mode>::to_memory(mem, size, ptr, indent_level);
+              return list_serializable<persistence_backend::basic_json<Compact>, Type, Caller, Mode>::to_memory(mem, size, ptr, indent_level);
 
             size_t whole_object_size = 0;
 
-            if (!internal::json::_allocate_string(mem, whole_object_size, 0, "{\n"))
-              return false;
-
             constexpr size_t element_count = Caller::compile_time_t::size;
+            if (!element_count && !internal::json::_allocate_opening<Compact>(mem, whole_object_size, '{', 0))
+              return false;
 
             if (!ct_to_memory_loop(gen_seq<element_count>(), mem, whole_object_size, ptr, indent_level))
               return false;
 
-            if (!internal::json::_allocate_string(mem, whole_object_size, 0, "\n"))
-              return false;
-            if (!internal::json::_allocate_string(mem, whole_object_size, indent_level, "}"))
+            if (!internal::json::_allocate_closing<Compact>(mem, whole_object_size, '}', indent_level))
               return false;
             size = whole_object_size;
             return true;
@@ -680,26 +741,43 @@ namespace neam
             );
             return res;
           }
+          /// \brief the key of the member \e Index with its ':' (it is only the name of the member: it doesn't depend on the object)
+          /// \throw std::bad_alloc if it can't be serialized (the fragment isn't initialized then: the next call tries again)
+          template<size_t Index>
+          static inline const std::string &ct_key_fragment()
+          {
+            static const std::string fragment = []() -> std::string
+            {
+              memory_allocator key_mem;
+              size_t key_size = 0;
+              if (!Caller::compile_time_t::template get_type<Index>::to_memory_single_key(key_mem, key_size, nullptr, 0) || key_mem.has_failed())
+                throw std::bad_alloc();
+              std::string res(reinterpret_cast<const char *>(key_mem.get_contiguous_data()), key_size);
+              res += ':';
+              return res;
+            }();
+            return fragment;
+          }
+
           template<size_t Index>
           static inline bool ct_to_memory_single(NCR_ENABLE_IF((Mode & to_memory_compiletime) != 0, memory_allocator) &mem, size_t &size, const Type *ptr, size_t indent_level)
           {
-            if (Index != 0) // Yay ! compile time switch !
+            // the key of a member never changes: it is serialized (with its ':') only once
+            const std::string *key_fragment = nullptr;
+            try
             {
-              if (!internal::json::_allocate_string(mem, size, 0, ",\n"))
-                return false;
+              key_fragment = &ct_key_fragment<Index>();
             }
-            if (!internal::json::_allocate_string(mem, size, indent_level + 1, ""))
-              return false;
-            size_t sz = 0;
-            if (!Caller::compile_time_t::template get_type<Index>::to_memory_single_key(mem, sz, ptr, indent_level + 1))
+            catch (std::bad_alloc &)
+            {
               return false;
+            }
 
-            size += sz;
-
-            if (!internal::json::_allocate_string(mem, size, 0, ":"))
+            // Yay ! compile time switch !
+            if (!internal::json::_allocate_opening<Compact>(mem, size, (Index ? ',' : '{'), indent_level + 1, key_fragment->data(), key_fragment->size()))
               return false;
 
-            sz = 0;
+            size_t sz = 0;
 
             if (!Caller::compile_time_t::template get_type<Index>::to_memory_single_value(mem, sz, ptr, indent_level + 1))
               return false;
@@ -42,6 +42,8 @@
 #include "../raw_data.hpp"
 
 #include "json_string_utilities.hpp"
+#include "json_number_utilities.hpp"
+#include "json_structural_index.hpp"
 
 namespace neam
 {
@@ -51,94 +53,6 @@ namespace neam
     {
       namespace json
       {
-        // // deserialization stuff
-
-        // I have to convert things[8-16-32-64-bit integers/double/float] from string
-        // but using the same function name (why on the earth this doesn't exists in the standard ?)
-        static inline bool number_from_string(const char *number, int64_t &dest)
-        {
-          static_assert((sizeof(int64_t) <= sizeof(long long)), "Unable to convert 64bit numbers from strings");
-          char *end;
-          if (sizeof(int64_t) <= sizeof(long))
-            dest = std::strtol(number, &end, 10);
-          else if (sizeof(int64_t) <= sizeof(long long))
-            dest = std::strtoll(number, &end, 10);
-          return dest != LLONG_MAX && dest != LONG_MAX;
-        }
-        static inline bool number_from_string(const char *number, uint64_t &dest)
-        {
-          static_assert((sizeof(int64_t) <= sizeof(long long)), "Unable to convert 64bit numbers from strings");
-          char *end;
-          if (sizeof(int64_t) <= sizeof(long))
-            dest = std::strtoul(number, &end, 10);
-          else if (sizeof(int64_t) <= sizeof(long long))
-            dest = std::strtoull(number, &end, 10);
-          return dest != ULLONG_MAX && dest != ULONG_MAX;
-        }
-
-        static inline bool number_from_string(const char *number, float &dest)
-        {
-          char *end;
-          dest = std::strtof(number, &end);
-          return dest != HUGE_VALF;
-        }
-        static inline bool number_from_string(const char *number, double &dest)
-        {
-          char *end;
-          dest = std::strtod(number, &end);
-          return dest != HUGE_VAL;
-        }
-
-        // And now all the possible derivations
-        static inline bool number_from_string(const char *number, uint8_t &dest)
-        {
-          uint64_t td;
-          if (!number_from_string(number, td) || td > std::numeric_limits<uint8_t>::max())
-            return false;
-          dest = td;
-          return true;
-        }
-        static inline bool number_from_string(const char *number, int8_t &dest)
-        {
-          int64_t td;
-          if (!number_from_string(number, td) || td > std::numeric_limits<int8_t>::max())
-            return false;
-          dest = td;
-          return true;
-        }
-        static inline bool number_from_string(const char *number, uint16_t &dest)
-        {
-          uint64_t td;
-          if (!number_from_string(number, td) || td > std::numeric_limits<uint16_t>::max())
-            return false;
-          dest = td;
-          return true;
-        }
-        static inline bool number_from_string(const char *number, int16_t &dest)
-        {
-          int64_t td;
-          if (!number_from_string(number, td) || td > std::numeric_limits<int16_t>::max())
-            return false;
-          dest = td;
-          return true;
-        }
-        static inline bool number_from_string(const char *number, uint32_t &dest)
-        {
-          uint64_t td;
-          if (!number_from_string(number, td) || td > std::numeric_limits<uint32_t>::max())
-            return false;
-          dest = td;
-          return true;
-        }
-        static inline bool number_from_string(const char *number, int32_t &dest)
-        {
-          int64_t td;
-          if (!number_from_string(number, td) || td > std::numeric_limits<int32_t>::max())
-            return false;
-          dest = td;
-          return true;
-        }
-
         enum class types
         {
           other = 0, // true, false, null
@@ -177,6 +91,8 @@ namespace neam
         // Advance to the next entry
         static inline bool advance_next(const char *memory, size_t max_size, size_t &index, char expect = 0)
         {
+          if (index >= max_size)
+            return false;
           switch (memory[index])
           {
             case ':': if (expect == ':') expect = 0;
@@ -204,11 +120,75 @@ namespace neam
           return false;
         }
 
+        /// \brief move \e index from the end of an element (as found by get_element_end_index()) to the next non-whitespace character:
+        /// past the closing character of a string, a list or a collection (numbers, true, false and null don't have one)
+        static inline size_t skip_element_end(const char *memory, size_t max_size, size_t index, types type)
+        {
+          if (index < max_size && (type == types::string || type == types::list || type == types::collection))
+            ++index;
+          while (index < max_size && std::isspace(memory[index]))
+            ++index;
+          return index;
+        }
+
+        /// \brief move \e index from the end of a key (as found by get_element_end_index()) to its value (past the ':')
+        /// \return false if the key isn't directly followed by a ':'
+        static inline bool skip_key_separator(const char *memory, size_t max_size, size_t &index)
+        {
+          size_t i = skip_element_end(memory, max_size, index, types::string);
+          if (i >= max_size || memory[i] != ':')
+            return false;
+          ++i;
+          while (i < max_size && std::isspace(memory[i]))
+            ++i;
+          index = i;
+          return i < max_size;
+        }
+
+        /// \brief move \e index from the end of an element of a list / collection (as found by get_element_end_index()) to the next element
+        /// \param closer the closing character of the list / collection (']' or '}')
+        /// \param[out] last set to true if the element is the last one (\e index is then left untouched)
+        /// \return false if the element is followed by neither a comma nor the end of the list / collection (another value, a wrong bracket, ...)
+        /// \note a nested list / collection is given without its closing character, so the last element may also end with the memory area
+        static inline bool next_element(const char *memory, size_t max_size, size_t &index, types type, char closer, bool &last)
+        {
+          size_t i = skip_element_end(memory, max_size, index, type);
+          if (i < max_size && memory[i] == ',')
+          {
+            ++i;
+            while (i < max_size && std::isspace(memory[i]))
+              ++i;
+            index = i;
+            last = false;
+            return true;
+          }
+
+          // the last element: only the (single) closing character can follow (and the whitespaces / the final \0 of the document)
+          last = true;
+          if (i < max_size && memory[i] == closer)
+            ++i;
+          while (i < max_size && (std::isspace(memory[i]) || memory[i] == '\0'))
+            ++i;
+          return i == max_size;
+        }
+
         static inline bool get_element_end_index(const char *memory, size_t max_size, size_t &index, types requested_type)
         {
           if (requested_type == types::bad_type)
             return false;
 
+          // the end of strings, lists and collections is in the index of the document (if there's one)
+          if (requested_type == types::string || requested_type == types::list || requested_type == types::collection)
+          {
+            structural_index *structure = structural_index::current();
+            const char *end = (structure ? structure->get_end(memory + index) : nullptr);
+            if (end && end < memory + max_size)
+            {
+              index = end - memory;
+              return true;
+            }
+          }
+
           bool in_qm = (memory[index] == '"'); // is inside quotation marks
           bool escaped = false; // if inside quotation marks, is last character an escape character
           size_t bracket_count = (memory[index] == '[' ? 1 : 0);
@@ -285,7 +265,8 @@ namespace neam
             if (old_escaped == escaped)
               escaped = false;
           }
-          return false;
+          // numbers, true, false and null can end with the memory area (in compact documents, they are directly followed by a ']' or a '}')
+          return requested_type == types::number || requested_type == types::other;
         }
       } // namespace json
     } // namespace internal
@@ -35,6 +35,7 @@
 #include <cstring>
 #include <new>
 #include <vector>
+#include <string>
 #include <iostream>
 
 #include "tools/execute_pack.hpp"
@@ -63,9 +64,13 @@ namespace neam
     {
       struct neam {}; // the "default" and faster backend.
       struct verbose {}; // a verbose backend (serialization only)
-      struct json {};    // a JSON backend (serialization only, TODO: deserialization)
+      template<bool Compact> struct basic_json {};
+      using json = basic_json<false>;         // a JSON backend (pretty printed). (an alias: it can't be forward declared as a struct)
+      using json_compact = basic_json<true>;  // the same JSON backend, but without any whitespace in the output
     } // namespace persitence_backend
 
+    class snapshot_process;
+
     /// \brief serialize data
     /// originally the class persistence was a namespace, but this caused some problems with private members
     /// (as in the private member would appear as a template parameter of \e serializable_object and \e constructible_serializable_object).
@@ -93,6 +98,18 @@ namespace neam
           return std::move(rdt.set(size, reinterpret_cast<int8_t *>(mem.give_up_data()), neam::assume_ownership));
         }
 
+        /// \brief serialize an object in the background and write it to the file \e path (as \e serialize() would return it)
+        /// The process is forked: the child serializes its copy-on-write view of the object while the caller goes on (and can modify the object).
+        /// The calling thread only pays for the fork(). The file is replaced only once it is completely written.
+        /// \note where fork() isn't available, the object is serialized and written before the function returns
+        /// \attention in the child process, only the calling thread exists: the serialization must not wait for a lock held by another thread.
+        ///            So the snapshot fails right away (without forking) while a thread of the library is working: a loop of a parallel
+        ///            serialization, or the committer thread of a storage. Don't take a snapshot while another thread writes to a storage.
+        /// \note defined in background_snapshot.hpp (included by persistence.hpp), so object.hpp doesn't pull fork() & co. in every file
+        /// \see snapshot_process
+        template<typename Backend, typename Type, typename... Params>
+        static snapshot_process background_snapshot(const Type &obj, const std::string &path, Params... p);
+
         /// \brief deserialize a class
         /// \return nullptr when it has failed
         /// \note It's up to you to \b delete the returned object !!!
@@ -148,6 +165,25 @@ namespace neam
 	  static_assert(sizeof(Type) + 1 != 0, "Missing metadata for Type. (did you forget to include STL files ?)");
         };
 
+        /// \brief read the key of a serialized object member and call \e func(const char *key, size_t key_size) with it
+        /// The default deserializes the key as a C string. Backends can specialize this to avoid the copy
+        /// \note the key is only valid during the call to \e func
+        template<typename Backend, typename Fuck = void>
+        struct key_reader
+        {
+          template<typename Func, typename... Params>
+          static inline bool read(const char *memory, size_t size, Func &&func, Params && ...p)
+          {
+            char *name = nullptr;
+            cr::allocation_transaction temp_transaction;
+            const bool res = serializable<Backend, char *>::from_memory(temp_transaction, memory, size, &name, std::forward<Params>(p)...) && name;
+            if (res)
+              func(const_cast<const char *>(name), strlen(name));
+            temp_transaction.rollback();
+            return res;
+          }
+        };
+
         /// \brief this serialize objects (like classes) property per property
         /// this generate meta-data used to generate code that will fill the object.
         /// \param OffsetTypeList is a list of \code typed_offset <type, offsetof(my_class, member)> \endcode that could be simplified with the macro \code NRP_TYPPED_OFFSET(my_class, member) \endcode
@@ -255,12 +291,8 @@ namespace neam
             {
               int *index = reinterpret_cast<int *>(pair);
               *index = -1; // not found
-              char *name = nullptr;
-              cr::allocation_transaction temp_transaction;
-              if (persistence::serializable<Backend, char *>::from_memory(temp_transaction, k_memory, k_size, &name, std::forward<Params>(k_p)...))
+              return persistence::key_reader<Backend>::read(k_memory, k_size, [index](const char *name, size_t key_size)
               {
-                size_t key_size = strlen(name);
-
                 // GET INDEX
                 size_t i = 0;
                 // Sorry.
@@ -269,11 +301,7 @@ namespace neam
                     *index = int(i) - 1
                   : 0)
                 );
-                temp_transaction.rollback();
-                return true;
-              }
-              temp_transaction.rollback();
-              return false;
+              }, std::forward<Params>(k_p)...);
             }
 
             template<typename... Params>
@@ -516,6 +544,7 @@ namespace neam
 #include "serializable_specs_gen.hpp"
 
 #include "serializable_wrappers.hpp"
+#include "serializable_pipeline.hpp"
 
 #include "serializable_specs_neam.hpp"
 #include "serializable_specs_verbose.hpp"
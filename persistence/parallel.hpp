@@ -0,0 +1,268 @@
+//
+// file : parallel.hpp
+// in : file:///home/tim/projects/persistence/persistence/parallel.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_2711430871653029148_1760393147__PARALLEL_HPP__
+# define __N_2711430871653029148_1760393147__PARALLEL_HPP__
+
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <system_error>
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      /// \brief below that amount of work (in bytes), parallel_for() does not use any other thread
+      constexpr size_t parallel_threshold = 1024 * 1024;
+
+      /// \brief keep track of the work of the threads of the library (the loops of parallel_for(), the storage commits),
+      /// so a process is only forked when no other thread holds one of its locks (see persistence::background_snapshot())
+      class thread_activity
+      {
+        public:
+          /// \brief mark the calling thread as working (for the lifetime of the scope)
+          class scope
+          {
+            public:
+              scope()
+              {
+                std::lock_guard<std::mutex> guard(gate());
+                ++count();
+              }
+              ~scope() { --count(); }
+
+              scope(const scope &) = delete;
+              scope &operator = (const scope &) = delete;
+          };
+
+          /// \brief prevent any thread of the library from starting to work (for the lifetime of the object or until release()).
+          /// Held around a fork(): no thread can start working (and take a lock) between the is_busy() check and the fork
+          class fork_guard
+          {
+            public:
+              fork_guard() : guard(gate()) {}
+
+              fork_guard(const fork_guard &) = delete;
+              fork_guard &operator = (const fork_guard &) = delete;
+
+              /// \brief return true if a thread of the library is working
+              bool is_busy() const
+              {
+                return count() != 0;
+              }
+
+              /// \brief let the threads work again
+              void release()
+              {
+                if (guard.owns_lock())
+                  guard.unlock();
+              }
+
+            private:
+              std::unique_lock<std::mutex> guard;
+          };
+
+          /// \brief true in a forked process: only the calling thread exists there, so parallel_for() doesn't use the pool
+          static bool &in_forked_process()
+          {
+            static bool value = false;
+            return value;
+          }
+
+        private:
+          static std::atomic<size_t> &count()
+          {
+            static std::atomic<size_t> value {0};
+            return value;
+          }
+
+          static std::mutex &gate()
+          {
+            static std::mutex value;
+            return value;
+          }
+      };
+
+      /// \brief the threads that run the calls of parallel_for(). They are started the first time they are needed,
+      /// then wait for work between two loops.
+      /// A loop queues a job per thread it wants, and the calling thread works on the loop too: when it is done, it takes back
+      /// the jobs no thread has started. So a loop never waits for a busy pool (nested loops included).
+      class worker_pool
+      {
+        public:
+          /// \brief a loop of parallel_for()
+          struct loop
+          {
+            void (*call)(void *func, size_t i);
+            void *func;
+            size_t count;
+            std::atomic<size_t> next {0};
+            size_t running = 0;           ///< the number of pool threads working on the loop (protected by the pool lock)
+            std::exception_ptr exception; ///< the first exception thrown by a call (protected by the pool lock)
+          };
+
+          static worker_pool &get()
+          {
+            static worker_pool pool;
+            return pool;
+          }
+
+          ~worker_pool()
+          {
+            {
+              std::lock_guard<std::mutex> guard(lock);
+              stop = true;
+            }
+            condition.notify_all();
+            for (auto &it : threads)
+              it.join();
+          }
+
+          /// \brief run \e lp on (at most) \e thread_count threads, the calling one included
+          /// \note the first exception thrown by a call stops the loop and is rethrown here
+          void run(loop &lp, size_t thread_count)
+          {
+            thread_activity::scope activity;
+            {
+              std::lock_guard<std::mutex> guard(lock);
+              _start_threads(thread_count - 1);
+              for (size_t i = 1; i < thread_count && i <= threads.size(); ++i)
+                jobs.push_back(&lp);
+            }
+            condition.notify_all();
+
+            _work(lp);
+
+            std::unique_lock<std::mutex> guard(lock);
+            jobs.erase(std::remove(jobs.begin(), jobs.end(), &lp), jobs.end());
+            done_condition.wait(guard, [&lp]() { return !lp.running; });
+            if (lp.exception)
+              std::rethrow_exception(lp.exception);
+          }
+
+        private:
+          worker_pool() = default;
+
+          void _start_threads(size_t count)
+          {
+            try
+            {
+              while (threads.size() < count)
+                threads.emplace_back(&worker_pool::_worker, this);
+            }
+            catch (std::system_error &) {} // not enough threads: the other ones will just do more work
+          }
+
+          void _work(loop &lp)
+          {
+            for (size_t i = lp.next++; i < lp.count; i = lp.next++)
+            {
+              try
+              {
+                lp.call(lp.func, i);
+              }
+              catch (...)
+              {
+                std::lock_guard<std::mutex> guard(lock);
+                if (!lp.exception)
+                  lp.exception = std::current_exception();
+                lp.next = lp.count; // the remaining calls are skipped
+              }
+            }
+          }
+
+          void _worker()
+          {
+            std::unique_lock<std::mutex> guard(lock);
+            while (true)
+            {
+              condition.wait(guard, [this]() { return stop || !jobs.empty(); });
+              if (stop)
+                return;
+              loop *lp = jobs.front();
+              jobs.pop_front();
+              ++lp->running;
+
+              guard.unlock();
+              _work(*lp);
+              guard.lock();
+
+              if (!--lp->running)
+                done_condition.notify_all();
+            }
+          }
+
+        private:
+          std::mutex lock;
+          std::condition_variable condition;      ///< signaled when jobs are queued
+          std::condition_variable done_condition; ///< signaled when the last pool thread leaves a loop
+          std::deque<loop *> jobs;
+          std::vector<std::thread> threads;
+          bool stop = false;
+      };
+
+      /// \brief call \e func(i) for every i in [0, count[, spread over the available cores
+      /// \param work the amount of work to do (in bytes, to know if using threads is worth it)
+      /// \note the calls are distributed dynamically (items may have very different costs), the calling thread participates too
+      /// \note if \e func throws, the remaining calls are skipped and the exception is rethrown on the calling thread
+      template<typename Func>
+      void parallel_for(size_t count, size_t work, Func &&func)
+      {
+        size_t thread_count = std::thread::hardware_concurrency();
+        if (thread_count > count)
+          thread_count = count;
+        if (thread_count <= 1 || work < parallel_threshold || thread_activity::in_forked_process())
+        {
+          for (size_t i = 0; i < count; ++i)
+            func(i);
+          return;
+        }
+
+        using func_t = typename std::remove_reference<Func>::type;
+        worker_pool::loop lp;
+        lp.call = [](void *f, size_t i) { (*reinterpret_cast<func_t *>(f))(i); };
+        lp.func = const_cast<void *>(static_cast<const void *>(std::addressof(func)));
+        lp.count = count;
+        worker_pool::get().run(lp, thread_count);
+      }
+    } // namespace internal
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_2711430871653029148_1760393147__PARALLEL_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
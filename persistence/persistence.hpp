@@ -32,6 +32,8 @@
 
 #include "object.hpp"
 #include "storage.hpp"
+#include "sharded_storage.hpp"
+#include "background_snapshot.hpp"
 
 namespace neam
 {
@@ -0,0 +1,401 @@
+//
+// file : serializable_pipeline.hpp
+// in : file:///home/tim/projects/persistence/persistence/serializable_pipeline.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_1255028346151238412_2020913855__SERIALIZABLE_PIPELINE_HPP__
+# define __N_1255028346151238412_2020913855__SERIALIZABLE_PIPELINE_HPP__
+
+#include <new>
+#include <memory>
+#include "object.hpp"
+#include "compression.hpp"
+#include "serializable_wrappers.hpp"
+#include "stream_hash.hpp"
+
+/// \file serializable_pipeline.hpp
+/// \brief a wrapper that chains other transformations (compression, checksum, xor) in a single pass
+///
+/// Stacking wrappers (like \code checksum<xor_data<compressed<T>>> \endcode) makes every one of them walk the whole
+/// serialized buffer (and some allocate a full-size temporary). The pipeline does it chunk by chunk instead:
+/// every chunk goes through all the stages while it is still in the cache.
+/// \code pipeline<my_class, stage::compress<>, stage::checksum, stage::xor_data<>> \endcode
+
+namespace neam
+{
+  namespace cr
+  {
+    /// \brief the stages that can be used in a pipeline (they are applied in order when serializing, in reverse order when deserializing)
+    namespace stage
+    {
+      /// \brief compress the data (see the \e compressed wrapper). There can be at most one compress stage in a pipeline.
+      template<unsigned Level = 1> struct compress {};
+
+      /// \brief compute a checksum of the data (as seen by that stage) and check it when deserializing
+      struct checksum {};
+
+      /// \brief xor the data (same PRNG as the \e xor_data wrapper)
+      template<uint64_t Seed = 0xA1A598773F70B5DB> struct xor_data {};
+    } // namespace stage
+
+    /// \brief run the serialized data of \e Type through some stages, chunk by chunk
+    template<typename Type, typename... Stages> class pipeline {};
+
+    namespace internal
+    {
+      /// \brief the header of a pipeline frame. It is followed by the chunks (a uint32_t size, then the data)
+      struct pipeline_header
+      {
+        uint32_t magic;
+        uint32_t chunk_size;
+        uint64_t raw_size;
+        uint64_t digest;
+      };
+
+      constexpr uint32_t pipeline_magic = 0x4C50434E; // "NCPL"
+
+      /// \brief the implementation of the stages.
+      /// \e encode and \e decode work on a single chunk. They can either work in-place or write in \e scratch and return it.
+      template<typename Stage> struct pipeline_stage_impl;
+
+      template<unsigned Level>
+      struct pipeline_stage_impl<stage::compress<Level>>
+      {
+        static constexpr bool resizes = true;
+
+        struct state
+        {
+          std::unique_ptr<lz::match_finder> mf;
+        };
+
+        static inline bool init(state &st)
+        {
+          if (Level > 0)
+          {
+            st.mf.reset(new(std::nothrow) lz::match_finder);
+            return !!st.mf;
+          }
+          return true;
+        }
+
+        static inline uint8_t *encode(state &st, uint8_t *data, size_t &size, uint8_t *scratch)
+        {
+          size = lz::write_block(st.mf.get(), data, size, scratch, Level);
+          return scratch;
+        }
+
+        /// \note \e raw_size is the size of the chunk before this stage (the other stages does not change the size of the data)
+        static inline uint8_t *decode(state &, uint8_t *data, size_t &size, uint8_t *dest, size_t raw_size)
+        {
+          size_t offset = 0;
+          if (!lz::read_block(data, size, offset, dest, raw_size) || offset != size)
+            return nullptr;
+          size = raw_size;
+          return dest;
+        }
+
+        static inline void finalize(state &, uint64_t &) {}
+      };
+
+      template<>
+      struct pipeline_stage_impl<stage::checksum>
+      {
+        static constexpr bool resizes = false;
+
+        struct state
+        {
+          stream_hash hash;
+        };
+
+        static inline bool init(state &) { return true; }
+
+        static inline uint8_t *encode(state &st, uint8_t *data, size_t &size, uint8_t *)
+        {
+          st.hash.update(data, size);
+          return data;
+        }
+
+        static inline uint8_t *decode(state &st, uint8_t *data, size_t &size, uint8_t *, size_t)
+        {
+          st.hash.update(data, size);
+          return data;
+        }
+
+        static inline void finalize(state &st, uint64_t &digest)
+        {
+          digest ^= st.hash.digest();
+        }
+      };
+
+      template<uint64_t Seed>
+      struct pipeline_stage_impl<stage::xor_data<Seed>>
+      {
+        static constexpr bool resizes = false;
+
+        struct state
+        {
+          xor_generator generator{Seed};
+        };
+
+        static inline bool init(state &) { return true; }
+
+        static inline uint8_t *encode(state &st, uint8_t *data, size_t &size, uint8_t *)
+        {
+          st.generator.apply(reinterpret_cast<char *>(data), size);
+          return data;
+        }
+
+        static inline uint8_t *decode(state &st, uint8_t *data, size_t &size, uint8_t *, size_t)
+        {
+          st.generator.apply(reinterpret_cast<char *>(data), size);
+          return data;
+        }
+
+        static inline void finalize(state &, uint64_t &) {}
+      };
+
+      /// \brief run a chunk through a list of stages
+      template<typename... Stages> struct pipeline_stage_list;
+
+      template<>
+      struct pipeline_stage_list<>
+      {
+        static constexpr size_t resize_count = 0;
+
+        struct state {};
+
+        static inline bool init(state &) { return true; }
+        static inline uint8_t *encode(state &, uint8_t *data, size_t &, uint8_t *) { return data; }
+        static inline uint8_t *decode(state &, uint8_t *data, size_t &, uint8_t *, size_t) { return data; }
+        static inline void finalize(state &, uint64_t &) {}
+      };
+
+      template<typename Stage, typename... Others>
+      struct pipeline_stage_list<Stage, Others...>
+      {
+        using impl = pipeline_stage_impl<Stage>;
+        using next = pipeline_stage_list<Others...>;
+
+        static constexpr size_t resize_count = (impl::resizes ? 1 : 0) + next::resize_count;
+
+        struct state
+        {
+          typename impl::state current;
+          typename next::state others;
+        };
+
+        static inline bool init(state &st)
+        {
+          return impl::init(st.current) && next::init(st.others);
+        }
+
+        // in order
+        static inline uint8_t *encode(state &st, uint8_t *data, size_t &size, uint8_t *scratch)
+        {
+          data = impl::encode(st.current, data, size, scratch);
+          return next::encode(st.others, data, size, scratch);
+        }
+
+        // in reverse order
+        static inline uint8_t *decode(state &st, uint8_t *data, size_t &size, uint8_t *dest, size_t raw_size)
+        {
+          data = next::decode(st.others, data, size, dest, raw_size);
+          if (!data)
+            return nullptr;
+          return impl::decode(st.current, data, size, dest, raw_size);
+        }
+
+        static inline void finalize(state &st, uint64_t &digest)
+        {
+          impl::finalize(st.current, digest);
+          next::finalize(st.others, digest);
+        }
+      };
+    } // namespace internal
+
+    /// \brief The pipeline wrapper.
+    /// \note the output of the inner serializer is still built in memory (the serializers can't stream their output),
+    ///       but all the stages are done in a single pass over it, and without any other full-size temporary.
+    template<typename Backend, typename Type, typename... Stages>
+    class persistence::serializable<Backend, pipeline<Type, Stages...>>
+    {
+      private:
+        using stage_list = internal::pipeline_stage_list<Stages...>;
+        static_assert(stage_list::resize_count <= 1, "a pipeline can't have more than one stage that changes the size of the data (compress)");
+
+        /// \brief the size of a chunk (in the input of the pipeline). Small enough to stay in the L2 cache.
+        static constexpr size_t chunk_size = internal::lz::block_size;
+
+      public:
+        template<typename... Params>
+        static bool from_memory(allocation_transaction &transaction, const char *memory, size_t size, pipeline<Type, Stages...> *ptr, Params... p)
+        {
+          return from_memory(transaction, memory, size, reinterpret_cast<Type *>(ptr), std::forward<Params>(p)...);
+        }
+
+        /// \brief deserialize the object
+        /// \param[in] memory the serialized object
+        /// \param[in] size the size of the memory area
+        /// \param[out] ptr a pointer to the object (the one that the function will fill)
+        /// \return true if successful
+        template<typename... Params>
+        static bool from_memory(allocation_transaction &transaction, const char *memory, size_t size, Type *ptr, Params... p)
+        {
+          if (size < sizeof(internal::pipeline_header))
+            return false;
+          internal::pipeline_header header;
+          memcpy(&header, memory, sizeof(header));
+          if (header.magic != internal::pipeline_magic || header.chunk_size != chunk_size)
+            return false;
+
+          typename stage_list::state st;
+          if (!stage_list::init(st))
+            return false;
+
+          const size_t raw_size = header.raw_size;
+          std::unique_ptr<uint8_t[]> scratch(new(std::nothrow) uint8_t[internal::lz::block_bound(chunk_size)]);
+          char *raw_memory = reinterpret_cast<char *>(operator new(raw_size ? raw_size : 1, std::nothrow));
+          if (!scratch || !raw_memory)
+          {
+            operator delete(raw_memory);
+            return false;
+          }
+
+          // the single pass: copy the chunk in a (hot) scratch buffer, undo the stages and write the result in place
+          size_t offset = sizeof(internal::pipeline_header);
+          bool res = true;
+          for (size_t raw_offset = 0; res && raw_offset < raw_size; raw_offset += chunk_size)
+          {
+            const size_t chunk_raw_size = (raw_size - raw_offset < chunk_size ? raw_size - raw_offset : chunk_size);
+            uint32_t encoded_size;
+            if (offset + sizeof(uint32_t) > size)
+            {
+              res = false;
+              break;
+            }
+            memcpy(&encoded_size, memory + offset, sizeof(uint32_t));
+            offset += sizeof(uint32_t);
+            if (offset + encoded_size > size || encoded_size > internal::lz::block_bound(chunk_size))
+            {
+              res = false;
+              break;
+            }
+
+            uint8_t *dest = reinterpret_cast<uint8_t *>(raw_memory) + raw_offset;
+            memcpy(scratch.get(), memory + offset, encoded_size);
+            offset += encoded_size;
+
+            size_t chunk_size_io = encoded_size;
+            uint8_t *data = stage_list::decode(st, scratch.get(), chunk_size_io, dest, chunk_raw_size);
+            if (!data || chunk_size_io != chunk_raw_size)
+              res = false;
+            else if (data != dest)
+              memcpy(dest, data, chunk_raw_size);
+          }
+
+          if (res)
+          {
+            uint64_t digest = 0;
+            stage_list::finalize(st, digest);
+            res = (digest == header.digest);
+          }
+
+          try
+          {
+            if (res)
+              res = serializable<Backend, Type>::from_memory(transaction, raw_memory, raw_size, ptr, std::forward<Params>(p)...);
+          } catch (...)
+          {
+            operator delete(raw_memory);
+            throw;
+          }
+          operator delete(raw_memory);
+          return res;
+        }
+
+        /// \brief serialize the object
+        /// \param[out] mem the serialized object (don't forget to \b free that memory !!!)
+        /// \param[out] size the size of the memory area
+        /// \param[in] ptr a pointer to the object (the one that the function will serialize)
+        /// \return true if successful
+        template<typename... Params>
+        static bool to_memory(memory_allocator &mem, size_t &size, const Type *ptr, Params... p)
+        {
+          size_t o_size = 0;
+          memory_allocator raw_mem;
+
+          if (!serializable<Backend, Type>::to_memory(raw_mem, o_size, ptr, std::forward<Params>(p)...) || raw_mem.has_failed())
+            return false;
+
+          typename stage_list::state st;
+          if (!stage_list::init(st))
+            return false;
+
+          const size_t index = mem.size();
+          if (!mem.allocate(sizeof(internal::pipeline_header)))
+            return false;
+          size = sizeof(internal::pipeline_header);
+
+          std::unique_ptr<uint8_t[]> scratch(new(std::nothrow) uint8_t[internal::lz::block_bound(chunk_size)]);
+          if (!scratch)
+            return false;
+
+          // the single pass (we own raw_mem, so the in-place stages can directly work on it)
+          uint8_t *raw_memory = reinterpret_cast<uint8_t *>(raw_mem.get_contiguous_data());
+          for (size_t raw_offset = 0; raw_offset < o_size; raw_offset += chunk_size)
+          {
+            size_t chunk_size_io = (o_size - raw_offset < chunk_size ? o_size - raw_offset : chunk_size);
+            const uint8_t *data = stage_list::encode(st, raw_memory + raw_offset, chunk_size_io, scratch.get());
+
+            uint8_t *dest = reinterpret_cast<uint8_t *>(mem.allocate(sizeof(uint32_t) + chunk_size_io));
+            if (!dest)
+              return false;
+            const uint32_t encoded_size = uint32_t(chunk_size_io);
+            memcpy(dest, &encoded_size, sizeof(uint32_t));
+            memcpy(dest + sizeof(uint32_t), data, chunk_size_io);
+            size += sizeof(uint32_t) + chunk_size_io;
+          }
+
+          internal::pipeline_header header;
+          header.magic = internal::pipeline_magic;
+          header.chunk_size = chunk_size;
+          header.raw_size = o_size;
+          header.digest = 0;
+          stage_list::finalize(st, header.digest);
+          memcpy(reinterpret_cast<uint8_t *>(mem.get_contiguous_data()) + index, &header, sizeof(header));
+          return true;
+        }
+
+        template<typename... Params>
+        static bool to_memory(memory_allocator &mem, size_t &size, const pipeline<Type, Stages...> *ptr, Params... p)
+        {
+          return to_memory(mem, size, reinterpret_cast<const Type *>(ptr), std::forward<Params>(p)...);
+        }
+    };
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_1255028346151238412_2020913855__SERIALIZABLE_PIPELINE_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
@@ -32,6 +32,7 @@
 
 #include <new>
 #include "object.hpp"
+#include "compression.hpp"
 
 namespace neam
 {
@@ -46,6 +47,10 @@ namespace neam
     /// \brief Xor the data
     template<typename Type, uint64_t Seed = 0xA1A598773F70B5DB> class xor_data {};
 
+    /// \brief Compress the data
+    /// \note Level 0 only frames the data, 1 is the fastest, higher levels (up to 9) search harder for matches
+    template<typename Type, unsigned Level = 1> class compressed {};
+
     template<typename Type, uint32_t Magic>
     class persistence::serializable<persistence_backend::neam, magic<Type, Magic>>
     {
@@ -202,12 +207,15 @@ namespace neam
         }
     };
 
-    /// \brief Xor wrapper. It simply xor the data by random number generated by a seedable PRNG
-    template<typename Backend, typename Type, uint64_t Seed>
-    class persistence::serializable<Backend, xor_data<Type, Seed>>
+    namespace internal
     {
-      private:
-        static inline uint8_t generator(uint64_t &seed)
+      /// \brief The PRNG used by the xor wrapper
+      /// \note the state is kept between calls, so the data can be xored chunk by chunk
+      struct xor_generator
+      {
+        uint64_t seed;
+
+        inline uint8_t operator()()
         {
           seed += (seed * seed) | 5;
           uint32_t res = (seed >> 32); // ?
@@ -215,11 +223,30 @@ namespace neam
         }
 
         /// \brief This version does things in-place
-        static inline char *xor_all_those_bytes(char *memory, size_t size)
+        inline void apply(char *memory, size_t size)
+        {
+          for (size_t i = 0; i < size; ++i)
+            memory[i] = memory[i] ^ (*this)();
+        }
+
+        /// \brief This version works on another memory area
+        inline void apply(const char *memory, char *dest, size_t size)
         {
-          uint64_t seed = Seed;
           for (size_t i = 0; i < size; ++i)
-            memory[i] = memory[i] ^ generator(seed);
+            dest[i] = memory[i] ^ (*this)();
+        }
+      };
+    } // namespace internal
+
+    /// \brief Xor wrapper. It simply xor the data by random number generated by a seedable PRNG
+    template<typename Backend, typename Type, uint64_t Seed>
+    class persistence::serializable<Backend, xor_data<Type, Seed>>
+    {
+      private:
+        /// \brief This version does things in-place
+        static inline char *xor_all_those_bytes(char *memory, size_t size)
+        {
+          internal::xor_generator{Seed}.apply(memory, size);
           return memory;
         }
 
@@ -229,9 +256,7 @@ namespace neam
           char *res = reinterpret_cast<char *>(operator new(size, std::nothrow));
           if (!res)
             return nullptr;
-          uint64_t seed = Seed;
-          for (size_t i = 0; i < size; ++i)
-            res[i] = memory[i] ^ generator(seed);
+          internal::xor_generator{Seed}.apply(memory, res, size);
           return res;
         }
 
@@ -296,6 +321,72 @@ namespace neam
           return to_memory(mem, size, reinterpret_cast<const Type *>(ptr), std::forward<Params>(p)...);
         }
     };
+
+    /// \brief Compression wrapper. It uses the LZ codec of compression.hpp
+    /// \note as every block is compressed independently, this is a good fit for big payloads, not for tiny ones
+    template<typename Backend, typename Type, unsigned Level>
+    class persistence::serializable<Backend, compressed<Type, Level>>
+    {
+      public:
+        template<typename... Params>
+        static bool from_memory(allocation_transaction &transaction, const char *memory, size_t size, compressed<Type, Level> *ptr, Params... p)
+        {
+          return from_memory(transaction, memory, size, reinterpret_cast<Type *>(ptr), std::forward<Params>(p)...);
+        }
+
+        /// \brief deserialize the object
+        /// \param[in] memory the serialized object
+        /// \param[in] size the size of the memory area
+        /// \param[out] ptr a pointer to the object (the one that the function will fill)
+        /// \return true if successful
+        template<typename... Params>
+        static bool from_memory(allocation_transaction &transaction, const char *memory, size_t size, Type *ptr, Params... p)
+        {
+          size_t raw_size;
+          if (!internal::lz::get_raw_size(memory, size, raw_size))
+            return false;
+
+          char *raw_memory = reinterpret_cast<char *>(operator new(raw_size ? raw_size : 1, std::nothrow));
+          if (!raw_memory)
+            return false;
+
+          bool res = internal::lz::decompress(memory, size, raw_memory, raw_size);
+          try
+          {
+            if (res)
+              res = serializable<Backend, Type>::from_memory(transaction, raw_memory, raw_size, ptr, std::forward<Params>(p)...);
+          } catch (...)
+          {
+            operator delete(raw_memory);
+            throw;
+          }
+          operator delete(raw_memory);
+          return res;
+        }
+
+        /// \brief serialize the object
+        /// \param[out] mem the serialized object (don't forget to \b free that memory !!!)
+        /// \param[out] size the size of the memory area
+        /// \param[in] ptr a pointer to the object (the one that the function will serialize)
+        /// \return true if successful
+        template<typename... Params>
+        static bool to_memory(memory_allocator &mem, size_t &size, const Type *ptr, Params... p)
+        {
+          size_t o_size = 0;
+          memory_allocator raw_mem;
+
+          if (!serializable<Backend, Type>::to_memory(raw_mem, o_size, ptr, std::forward<Params>(p)...) || raw_mem.has_failed())
+            return false;
+
+          return internal::lz::compress(mem, size, reinterpret_cast<const char *>(raw_mem.get_contiguous_data()), o_size, Level);
+        }
+
+        template<typename... Params>
+        static bool to_memory(memory_allocator &mem, size_t &size, const compressed<Type, Level> *ptr, Params... p)
+        {
+          return to_memory(mem, size, reinterpret_cast<const Type *>(ptr), std::forward<Params>(p)...);
+        }
+    };
   } // namespace cr
 } // namespace neam
 
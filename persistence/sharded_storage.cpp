@@ -0,0 +1,165 @@
+//
+// file : sharded_storage.cpp
+// in : file:///home/tim/projects/persistence/persistence/sharded_storage.cpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <algorithm>
+#include <atomic>
+#include "sharded_storage.hpp"
+#include "stream_hash.hpp"
+#include "parallel.hpp"
+
+neam::cr::sharded_storage::sharded_storage(const std::string &filename, size_t shard_count, uint32_t _flags) : flags(_flags)
+{
+  // (no shard for a shard count of 0: the storage is not valid)
+  shards.reserve(shard_count);
+  for (size_t i = 0; i < shard_count; ++i)
+    shards.emplace_back(new storage(filename + "." + std::to_string(i), flags));
+}
+
+size_t neam::cr::sharded_storage::get_shard_index(const std::string &name) const
+{
+  neam::cr::internal::stream_hash hash;
+  hash.update(reinterpret_cast<const uint8_t *>(name.data()), name.size());
+
+  if (shards.empty())
+    return 0;
+
+  // (the low bits are the ones used by the hash table of the shard)
+  return (hash.digest() >> 32) % shards.size();
+}
+
+bool neam::cr::sharded_storage::is_valid()
+{
+  if (shards.empty())
+    return false;
+  for (auto &it : shards)
+  {
+    if (!it->is_valid())
+      return false;
+  }
+  return true;
+}
+
+void neam::cr::sharded_storage::truncate()
+{
+  // (each shard syncs its file: always worth a thread)
+  internal::parallel_for(shards.size(), internal::parallel_threshold, [this](size_t i)
+  {
+    shards[i]->truncate();
+  });
+}
+
+bool neam::cr::sharded_storage::compact()
+{
+  std::atomic<bool> res {!shards.empty()};
+  internal::parallel_for(shards.size(), internal::parallel_threshold, [this, &res](size_t i)
+  {
+    if (!shards[i]->compact())
+      res = false;
+  });
+  return res;
+}
+
+template<typename ListFunc>
+std::vector<neam::cr::storage::section_handle> neam::cr::sharded_storage::_merge_sections(ListFunc &&list) const
+{
+  std::vector<storage::section_handle> ret;
+  for (auto &it : shards)
+  {
+    std::vector<storage::section_handle> shard_sections = list(*it);
+    const size_t middle = ret.size();
+    ret.insert(ret.end(), shard_sections.begin(), shard_sections.end());
+    std::inplace_merge(ret.begin(), ret.begin() + middle, ret.end(), [](const storage::section_handle &a, const storage::section_handle &b)
+    {
+      return a.get_name() < b.get_name();
+    });
+  }
+  return ret;
+}
+
+std::vector<neam::cr::storage::section_handle> neam::cr::sharded_storage::list_sections(const std::string &prefix) const
+{
+  return _merge_sections([&prefix](const storage &shard) { return shard.list_sections(prefix); });
+}
+
+std::vector<neam::cr::storage::section_handle> neam::cr::sharded_storage::list_sections(const std::string &first, const std::string &last) const
+{
+  return _merge_sections([&first, &last](const storage &shard) { return shard.list_sections(first, last); });
+}
+
+void neam::cr::sharded_storage::set_cache_size(uint64_t max_size_per_shard)
+{
+  for (auto &it : shards)
+    it->set_cache_size(max_size_per_shard);
+}
+
+neam::cr::sharded_storage::batch::batch(sharded_storage &_owner) : owner(_owner)
+{
+  batches.reserve(owner.shards.size());
+  for (auto &it : owner.shards)
+    batches.emplace_back(*it);
+}
+
+bool neam::cr::sharded_storage::batch::commit()
+{
+  // each shard is written and synced by its committer thread (thread_safe shards), or by a thread of the pool
+  // (so that no committer thread is left running in the other shards)
+  if (!(owner.flags & storage::thread_safe))
+  {
+    std::atomic<bool> res {true};
+    internal::parallel_for(batches.size(), internal::parallel_threshold, [this, &res](size_t i)
+    {
+      if (batches[i].size() && !batches[i].commit())
+        res = false;
+    });
+    return res;
+  }
+
+  std::vector<std::future<bool>> results;
+  for (storage::batch &it : batches)
+  {
+    if (it.size())
+      results.push_back(it.commit_async());
+  }
+
+  bool res = true;
+  for (auto &it : results)
+    res &= it.get();
+  return res;
+}
+
+void neam::cr::sharded_storage::batch::clear()
+{
+  for (storage::batch &it : batches)
+    it.clear();
+}
+
+size_t neam::cr::sharded_storage::batch::size() const
+{
+  size_t ret = 0;
+  for (const storage::batch &it : batches)
+    ret += it.size();
+  return ret;
+}
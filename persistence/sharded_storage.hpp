@@ -0,0 +1,194 @@
+//
+// file : sharded_storage.hpp
+// in : file:///home/tim/projects/persistence/persistence/sharded_storage.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_1648213397205911437_2870551129__SHARDED_STORAGE_HPP__
+# define __N_1648213397205911437_2870551129__SHARDED_STORAGE_HPP__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include "storage.hpp"
+
+namespace neam
+{
+  namespace cr
+  {
+    /// \brief a storage split across multiple files (the shards): each section goes in the shard its name hashes to
+    /// Each shard is a \e storage with its own file, index and locks, so writes to different shards (and their syncs) run in parallel.
+    /// The shards are the files "<filename>.0" to "<filename>.<shard_count - 1>"
+    /// \note a sharded storage must always be opened with the same shard count
+    /// \note a shard count of 0 is rejected: the storage has no shard, is not valid and every read or write fails
+    class sharded_storage
+    {
+      public:
+        class batch;
+
+      public:
+        /// \param flags the flags of every shard (see storage::flags)
+        sharded_storage(const std::string &filename, size_t shard_count, uint32_t flags = storage::none);
+
+        /// \brief return the number of shards
+        size_t get_shard_count() const
+        {
+          return shards.size();
+        }
+
+        /// \brief return the shard a section is in (the storage must have shards)
+        storage &get_shard(const std::string &name)
+        {
+          return *shards[get_shard_index(name)];
+        }
+
+        /// \brief return the index of the shard a section is in
+        size_t get_shard_index(const std::string &name) const;
+
+        /// \brief return a shard by its index
+        storage &get_shard_at(size_t index)
+        {
+          return *shards[index];
+        }
+
+        /// \brief return \b true if the storage has shards and every shard is a valid \e storage file
+        bool is_valid();
+
+        /// \brief truncate every shard
+        void truncate();
+
+        /// \brief test whether or not if the storage contains the object with the name \e name
+        bool contains(const std::string &name) const
+        {
+          return !shards.empty() && shards[get_shard_index(name)]->contains(name);
+        }
+
+        /// \brief remove a section
+        void remove(const std::string &name)
+        {
+          if (!shards.empty())
+            get_shard(name).remove(name);
+        }
+
+        /// \brief compact every shard (in parallel)
+        bool compact();
+
+        /// \brief return the sections whose name starts with \e prefix (of every shard), in the order of their names
+        std::vector<storage::section_handle> list_sections(const std::string &prefix = std::string()) const;
+
+        /// \brief return the sections whose name is in [\e first, \e last) (of every shard), in the order of their names (an empty \e last means no upper bound)
+        std::vector<storage::section_handle> list_sections(const std::string &first, const std::string &last) const;
+
+        /// \brief set the size of the object cache of each shard (see storage::set_cache_size())
+        void set_cache_size(uint64_t max_size_per_shard);
+
+        /// \brief write the object to its shard
+        template<typename Object>
+        bool write_to_file(const std::string &name, const Object &obj)
+        {
+          return !shards.empty() && get_shard(name).write_to_file(name, obj);
+        }
+
+        /// \brief write the object to its shard without waiting for the disk (see storage::write_to_file_async())
+        template<typename Object>
+        std::future<bool> write_to_file_async(const std::string &name, const Object &obj)
+        {
+          if (shards.empty())
+          {
+            std::promise<bool> result;
+            result.set_value(false);
+            return result.get_future();
+          }
+          return get_shard(name).write_to_file_async(name, obj);
+        }
+
+        template<typename Object>
+        Object *load_from_file(const std::string &name)
+        {
+          if (shards.empty())
+            return nullptr;
+          return get_shard(name).load_from_file<Object>(name);
+        }
+
+        /// \brief load an object through the object cache of its shard (see storage::load_shared())
+        template<typename Object>
+        std::shared_ptr<const Object> load_shared(const std::string &name)
+        {
+          if (shards.empty())
+            return nullptr;
+          return get_shard(name).load_shared<Object>(name);
+        }
+
+      private:
+        /// \brief merge the sections listed by every shard (\e list(shard) returns the sorted sections of a shard)
+        template<typename ListFunc>
+        std::vector<storage::section_handle> _merge_sections(ListFunc &&list) const;
+
+      private:
+        std::vector<std::unique_ptr<storage>> shards;
+        uint32_t flags;
+    };
+
+    /// \brief a set of writes and removes that are applied to a sharded storage with a single sync of each shard involved
+    /// The shards are written and synced in parallel (by their committer thread for thread_safe storages).
+    /// \note the batch is atomic for each shard, but not across shards: if a shard fails, the others still apply their operations
+    class sharded_storage::batch
+    {
+      public:
+        explicit batch(sharded_storage &_owner);
+
+        /// \brief add the write of an object to the batch (the object is serialized now)
+        template<typename Object>
+        bool write_to_file(const std::string &name, const Object &obj)
+        {
+          return !batches.empty() && batches[owner.get_shard_index(name)].write_to_file(name, obj);
+        }
+
+        /// \brief add the removal of a section to the batch
+        void remove(const std::string &name)
+        {
+          if (!batches.empty())
+            batches[owner.get_shard_index(name)].remove(name);
+        }
+
+        /// \brief apply all the operations (the batch is then empty)
+        /// \return false if the operations of at least one shard can't be applied
+        bool commit();
+
+        /// \brief drop all the operations
+        void clear();
+
+        /// \brief return the number of operations in the batch
+        size_t size() const;
+
+      private:
+        sharded_storage &owner;
+        std::vector<storage::batch> batches; ///< one per shard
+    };
+  } // namespace r
+} // namespace neam
+
+#endif /*__N_1648213397205911437_2870551129__SHARDED_STORAGE_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
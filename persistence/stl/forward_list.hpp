@@ -68,6 +68,7 @@ namespace neam
             temp_transaction.rollback(); // free up the temporary memory
             return true;
           }
+          temp_transaction.rollback(); // (the elements deserialized before the failure)
           return false;
         }
 
@@ -19,22 +19,212 @@
 // SOFTWARE.
 //
 
+#include <cstdio>
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <limits>
 #include "storage.hpp"
+#include "parallel.hpp"
+#include "stream_hash.hpp"
 #include "stl/map.hpp"
 #include "stl/string.hpp"
 
-neam::cr::storage::storage(const std::string &_filename) : mapped_file(nullptr), filename(_filename)
+namespace
 {
-  file.open(filename, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+  /// \brief the header of an append_only storage file. It is followed by the records
+  struct log_file_header
+  {
+    uint32_t magic;
+    uint32_t version;
+  };
+
+  constexpr uint32_t log_magic = 0x474C434E; // "NCLG"
+  constexpr uint32_t log_version = 1;
+
+  /// \brief the header of a record. It is followed by the name and the data (both xored)
+  struct log_record_header
+  {
+    uint32_t type;
+    uint32_t name_size;
+    uint64_t data_size;
+    uint64_t hash; ///< hash of the fields above and of the (xored) name and data
+  };
+
+  enum log_record_type : uint32_t
+  {
+    record_write = 1,
+    record_remove = 2,
+
+    record_type_mask = 0xFF,
+    record_compressed = 1 << 8,
+    record_batched = 1 << 9,   ///< the record is part of a batch that continues with the next record
+  };
+
+  /// \brief the seed of the xor sequences (it is combined with the offset of what is xored in the file)
+  constexpr uint64_t xor_seed = 0xA1A598773F70B5DB;
+
+  /// \brief below that size, the log is never automatically compacted
+  constexpr uint64_t log_compaction_threshold = 1024 * 1024;
+
+  /// \brief the header of a storage file (when not append_only). It is followed by the section table, then by the sections
+  /// The table is made of a hash table (bucket_count uint32_t: the index of an entry + 1, or 0), the entries (sorted by name), then the names.
+  /// Every entry and every name is xored on its own, so a lookup only reads the buckets it probes and the entries they point to.
+  struct section_file_header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t section_count;
+    uint64_t bucket_count; ///< a power of 2
+    uint64_t table_size;
+  };
+
+  constexpr uint32_t section_magic = 0x5453434E; // "NCST"
+  constexpr uint32_t section_version = 2;
+
+  /// \brief an entry of the section table
+  struct section_entry
+  {
+    uint64_t offset;      ///< where the section is in the file
+    uint64_t size;        ///< the size of the section in the file
+    uint64_t raw_size;    ///< the size of the section once decompressed
+    uint64_t hash;        ///< hash of the (xored) section
+    uint64_t name_hash;
+    uint32_t name_offset; ///< where the name is, from the start of the names
+    uint32_t name_size;
+    uint32_t flags;
+    uint32_t check;       ///< a hash of the entry (with check = 0) and of the name
+  };
+
+  enum section_flags : uint32_t
+  {
+    section_compressed = 1 << 0,
+
+    section_log_record = 1 << 16, ///< (in memory only) the location is a record of a log file
+  };
+
+  /// \brief sections are 8 bytes aligned in the file
+  inline uint64_t section_align(uint64_t offset)
+  {
+    return (offset + 7) & ~uint64_t(7);
+  }
+
+  inline uint64_t hash_of(const char *data, size_t size)
+  {
+    neam::cr::internal::stream_hash hash;
+    hash.update(reinterpret_cast<const uint8_t *>(data), size);
+    return hash.digest();
+  }
+
+  inline uint32_t entry_check(section_entry entry, const char *name)
+  {
+    entry.check = 0;
+    neam::cr::internal::stream_hash hash;
+    hash.update(reinterpret_cast<const uint8_t *>(&entry), sizeof(entry));
+    hash.update(reinterpret_cast<const uint8_t *>(name), entry.name_size);
+    return uint32_t(hash.digest());
+  }
+
+  /// \brief the number of buckets for \e count sections (the hash table is at most half full)
+  inline uint64_t bucket_count_for(uint64_t count)
+  {
+    uint64_t res = 2;
+    while (res < 2 * count)
+      res *= 2;
+    return res;
+  }
+
+  uint64_t record_hash(const log_record_header &header, const char *body)
+  {
+    neam::cr::internal::stream_hash hash;
+    hash.update(reinterpret_cast<const uint8_t *>(&header), offsetof(log_record_header, hash));
+    hash.update(reinterpret_cast<const uint8_t *>(body), header.name_size + header.data_size);
+    return hash.digest();
+  }
+
+  /// \brief append a record to \e mem
+  /// \param offset the offset of the record in the file (the xor sequence depends on it)
+  /// \return the size of the record, 0 on failure
+  uint64_t encode_record(neam::cr::memory_allocator &mem, uint64_t offset, uint32_t type, const std::string &name, const neam::cr::raw_data *data, bool compress)
+  {
+    const char *payload = data ? reinterpret_cast<const char *>(data->data) : nullptr;
+    size_t payload_size = data ? data->size : 0;
+
+    neam::cr::memory_allocator compressed_mem;
+    if (compress && payload_size)
+    {
+      size_t compressed_size = 0;
+      if (neam::cr::internal::lz::compress(compressed_mem, compressed_size, payload, payload_size, 1) && compressed_size < payload_size)
+      {
+        payload = reinterpret_cast<const char *>(compressed_mem.get_contiguous_data());
+        payload_size = compressed_size;
+        type |= record_compressed;
+      }
+    }
+
+    const uint64_t record_size = sizeof(log_record_header) + name.size() + payload_size;
+    char *record = reinterpret_cast<char *>(mem.allocate(record_size));
+    if (!record)
+      return 0;
+
+    log_record_header header;
+    header.type = type;
+    header.name_size = name.size();
+    header.data_size = payload_size;
+
+    char *body = record + sizeof(log_record_header);
+    neam::cr::internal::xor_generator gen {xor_seed ^ offset};
+    gen.apply(name.data(), body, name.size());
+    gen.apply(payload, body + name.size(), payload_size);
+
+    header.hash = record_hash(header, body);
+    memcpy(record, &header, sizeof(header));
+    return record_size;
+  }
+} // namespace
+
+neam::cr::storage::storage(const std::string &_filename, uint32_t _flags) : filename(_filename), flags(_flags)
+{
+  file.open(filename);
 
   _load();
+
+  if (flags & thread_safe)
+    committer = std::thread(&storage::_committer_loop, this);
 }
 
 neam::cr::storage::~storage()
 {
-  _sync();
-  if (mapped_file)
-    delete mapped_file;
+  if (committer.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> guard(queue_lock);
+      stop_committer = true;
+    }
+    queue_condition.notify_one();
+    committer.join();
+  }
+
+  if (dirty)
+    _sync();
+}
+
+std::shared_ptr<const neam::cr::raw_data> neam::cr::storage::section::get() const
+{
+  if (!lazy)
+    return std::shared_ptr<const raw_data>(shared_from_this(), &data);
+
+  std::shared_ptr<raw_data> decoded = std::make_shared<raw_data>();
+  if (!_decode_section(mapping->data(), location, *decoded))
+    return nullptr;
+  return decoded;
+}
+
+uint64_t neam::cr::storage::section::get_size() const
+{
+  return lazy ? location.raw_size : data.size;
 }
 
 std::string neam::cr::storage::get_filename() const
@@ -44,119 +234,1140 @@ std::string neam::cr::storage::get_filename() const
 
 bool neam::cr::storage::exists() const
 {
+  std::lock_guard<std::recursive_mutex> guard(state_lock);
   return file.is_open();
 }
 
 bool neam::cr::storage::is_valid()
 {
-  return exists() && mapped_file;
+  return exists() && _get_index();
 }
 
 void neam::cr::storage::truncate()
 {
-  if (mapped_file)
-    mapped_file->clear();
-  else
-    mapped_file = new std::map<std::string, raw_data>;
+  std::lock_guard<std::recursive_mutex> guard(state_lock);
+  _publish(std::make_shared<section_index>());
+  _cache_invalidate(nullptr);
   _sync();
 }
 
+bool neam::cr::storage::compact()
+{
+  return _sync();
+}
+
 bool neam::cr::storage::contains(const std::string &name) const
 {
-  if (mapped_file)
-    return mapped_file->count(name);
-  return false;
+  std::shared_ptr<const section_index> index = _get_index();
+  return index && index->find(name);
+}
+
+std::vector<neam::cr::storage::section_handle> neam::cr::storage::list_sections(const std::string &prefix) const
+{
+  // the sections of the prefix are the ones in [prefix, next prefix)
+  std::string last = prefix;
+  while (!last.empty() && static_cast<unsigned char>(last.back()) == 0xFF)
+    last.pop_back();
+  if (!last.empty())
+    last.back() = static_cast<char>(static_cast<unsigned char>(last.back()) + 1);
+
+  return list_sections(prefix, last);
+}
+
+std::vector<neam::cr::storage::section_handle> neam::cr::storage::list_sections(const std::string &first, const std::string &last) const
+{
+  std::vector<section_handle> ret;
+  std::shared_ptr<const section_index> index = _get_index();
+  if (!index)
+    return ret;
+
+  index->for_each(first, last, [&ret](const std::string &name, const std::shared_ptr<section> &sec)
+  {
+    ret.emplace_back(section_handle(name, sec));
+  });
+  return ret;
 }
 
 void neam::cr::storage::remove(const std::string &name)
 {
-  if (mapped_file)
-    mapped_file->erase(name);
+  if (!contains(name))
+    return;
+
+  std::map<std::string, batch_operation> operations;
+  operations[name].remove = true;
+
+  if (_uses_committer() || (flags & append_only))
+  {
+    _commit(operations);
+    return;
+  }
+
+  // the file will be synced later
+  std::lock_guard<std::recursive_mutex> guard(state_lock);
+  std::shared_ptr<const section_index> index = _get_index();
+  if (!index)
+    return;
+
+  std::shared_ptr<section_index> next = std::make_shared<section_index>(*index);
+  next->remove(name);
+  _publish(std::move(next));
+  _cache_invalidate(&name);
+  dirty = true;
+}
+
+std::shared_ptr<neam::cr::storage::section> neam::cr::storage::_get_section(const std::string &name) const
+{
+  std::shared_ptr<const section_index> index = _get_index();
+  if (!index)
+    return nullptr;
+  return index->find(name);
 }
 
-bool neam::cr::storage::_read_from_file(const std::string &name, char *&memory, size_t &size)
+bool neam::cr::storage::section_table::get_entry(uint64_t index, std::string *name, section_location &location) const
 {
-  memory = nullptr;
-  size = 0;
+  const char *memory = mapping->data();
+  const uint64_t size = mapping->get_size();
 
-  if (!mapped_file)
+  section_entry entry;
+  const uint64_t entry_offset = entries_offset + index * sizeof(section_entry);
+  internal::xor_generator {xor_seed ^ entry_offset}.apply(memory + entry_offset, reinterpret_cast<char *>(&entry), sizeof(entry));
+  if (uint64_t(entry.name_offset) + entry.name_size > names_size)
+    return false;
+  if (entry.offset > size || entry.size > size - entry.offset)
+    return false;
+  if (!(entry.flags & section_compressed) && entry.raw_size != entry.size)
     return false;
 
-  auto it = mapped_file->find(name);
-  if (it == mapped_file->end())
+  std::string local_name;
+  if (!name)
+    name = &local_name;
+  name->resize(entry.name_size);
+  const uint64_t name_offset = names_offset + entry.name_offset;
+  internal::xor_generator {xor_seed ^ name_offset}.apply(memory + name_offset, &(*name)[0], entry.name_size);
+  if (entry_check(entry, name->data()) != entry.check)
     return false;
 
-  memory = reinterpret_cast<char *>(it->second.data);
-  size = it->second.size;
+  location = section_location {entry.offset, entry.size, entry.raw_size, entry.hash, entry.flags, 0};
   return true;
 }
 
+uint64_t neam::cr::storage::section_table::lower_bound(const std::string &name) const
+{
+  if (!mapping)
+    return 0;
+
+  // the entries are sorted by names
+  const char *memory = mapping->data();
+  std::string entry_name;
+  uint64_t first = 0;
+  uint64_t count = entry_count;
+  while (count > 0)
+  {
+    const uint64_t step = count / 2;
+    const uint64_t middle = first + step;
+
+    section_entry entry;
+    const uint64_t entry_offset = entries_offset + middle * sizeof(section_entry);
+    internal::xor_generator {xor_seed ^ entry_offset}.apply(memory + entry_offset, reinterpret_cast<char *>(&entry), sizeof(entry));
+    entry_name.clear();
+    if (uint64_t(entry.name_offset) + entry.name_size <= names_size)
+    {
+      entry_name.resize(entry.name_size);
+      const uint64_t name_offset = names_offset + entry.name_offset;
+      internal::xor_generator {xor_seed ^ name_offset}.apply(memory + name_offset, &entry_name[0], entry.name_size);
+    }
+
+    if (entry_name < name)
+    {
+      first = middle + 1;
+      count -= step + 1;
+    }
+    else
+      count = step;
+  }
+  return first;
+}
+
+bool neam::cr::storage::section_table::find(const std::string &name, section_location &location) const
+{
+  if (!mapping || !entry_count)
+    return false;
+
+  const char *memory = mapping->data();
+  const uint64_t name_hash = hash_of(name.data(), name.size());
+  const uint64_t mask = bucket_count - 1;
+  std::string entry_name;
+  for (uint64_t i = 0, bucket = name_hash & mask; i < bucket_count; ++i, bucket = (bucket + 1) & mask)
+  {
+    uint32_t entry_index;
+    memcpy(&entry_index, memory + buckets_offset + bucket * sizeof(uint32_t), sizeof(entry_index));
+    if (!entry_index || entry_index > entry_count)
+      return false;
+    --entry_index;
+
+    section_entry entry;
+    const uint64_t entry_offset = entries_offset + entry_index * sizeof(section_entry);
+    internal::xor_generator {xor_seed ^ entry_offset}.apply(memory + entry_offset, reinterpret_cast<char *>(&entry), sizeof(entry));
+    if (entry.name_hash != name_hash || entry.name_size != name.size())
+      continue;
+    if (get_entry(entry_index, &entry_name, location) && entry_name == name)
+      return true;
+  }
+  return false;
+}
+
+std::shared_ptr<neam::cr::storage::section> neam::cr::storage::section_table::get_section(const section_location &location) const
+{
+  return std::make_shared<section>(mapping, location);
+}
+
+std::shared_ptr<neam::cr::storage::section> neam::cr::storage::section_index::find(const std::string &name) const
+{
+  auto it = changes.find(name);
+  if (it != changes.end())
+    return it->second;
+
+  section_location location;
+  if (!table.find(name, location))
+    return nullptr;
+  return table.get_section(location);
+}
+
+void neam::cr::storage::section_index::remove(const std::string &name)
+{
+  section_location location;
+  if (table.find(name, location))
+    changes[name] = nullptr;
+  else
+    changes.erase(name);
+}
+
+template<typename Func>
+void neam::cr::storage::section_index::for_each(const std::string &first, const std::string &last, Func &&func) const
+{
+  const auto in_range = [&last](const std::string &name) { return last.empty() || name < last; };
+
+  // merge the table (sorted by names) with the changes
+  auto it = changes.lower_bound(first);
+  std::string name;
+  section_location location;
+  for (uint64_t i = table.lower_bound(first); i < table.entry_count; ++i)
+  {
+    if (!table.get_entry(i, &name, location))
+      continue; // a corrupted entry: the section is lost
+    if (!in_range(name))
+      break;
+
+    for (; it != changes.end() && it->first < name; ++it)
+    {
+      if (it->second)
+        func(it->first, it->second);
+    }
+    if (it != changes.end() && it->first == name)
+    {
+      if (it->second)
+        func(it->first, it->second);
+      ++it;
+      continue;
+    }
+    func(name, table.get_section(location));
+  }
+  for (; it != changes.end() && in_range(it->first); ++it)
+  {
+    if (it->second)
+      func(it->first, it->second);
+  }
+}
+
+template<typename Func>
+void neam::cr::storage::section_index::for_each(Func &&func) const
+{
+  for_each(std::string(), std::string(), std::forward<Func>(func));
+}
+
+std::shared_ptr<const neam::cr::storage::section_index> neam::cr::storage::_get_index() const
+{
+  return std::atomic_load(&sections);
+}
+
+void neam::cr::storage::_publish(std::shared_ptr<const section_index> index)
+{
+  std::atomic_store(&sections, std::move(index));
+}
+
+void neam::cr::storage::set_cache_size(uint64_t max_size)
+{
+  std::lock_guard<std::mutex> guard(cache_lock);
+  cache_max_size = max_size;
+  _cache_evict();
+}
+
+bool neam::cr::storage::_cache_find(const std::string &name, const void *type, std::shared_ptr<const void> &object, uint64_t &generation)
+{
+  std::lock_guard<std::mutex> guard(cache_lock);
+  generation = cache_generation;
+
+  auto range = cache_map.equal_range(name);
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    if (it->second->type != type)
+      continue;
+    cache_lru.splice(cache_lru.begin(), cache_lru, it->second);
+    object = it->second->object;
+    return true;
+  }
+  return false;
+}
+
+void neam::cr::storage::_cache_insert(const std::string &name, const void *type, std::shared_ptr<const void> object, uint64_t size, uint64_t generation)
+{
+  std::lock_guard<std::mutex> guard(cache_lock);
+  if (generation != cache_generation || size > cache_max_size)
+    return;
+
+  // another thread may have inserted it in the meantime
+  auto range = cache_map.equal_range(name);
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    if (it->second->type == type)
+      return;
+  }
+
+  cache_lru.push_front(cache_entry {name, type, std::move(object), size});
+  cache_map.emplace(name, cache_lru.begin());
+  cache_size += size;
+  _cache_evict();
+}
+
+void neam::cr::storage::_cache_invalidate(const std::string *name)
+{
+  std::lock_guard<std::mutex> guard(cache_lock);
+  ++cache_generation;
+
+  if (!name)
+  {
+    cache_map.clear();
+    cache_lru.clear();
+    cache_size = 0;
+    return;
+  }
+
+  auto range = cache_map.equal_range(*name);
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    cache_size -= it->second->size;
+    cache_lru.erase(it->second);
+  }
+  cache_map.erase(range.first, range.second);
+}
+
+void neam::cr::storage::_cache_evict()
+{
+  while (cache_size > cache_max_size)
+  {
+    cache_entry &entry = cache_lru.back();
+    auto range = cache_map.equal_range(entry.name);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+      if (it->second->type == entry.type)
+      {
+        cache_map.erase(it);
+        break;
+      }
+    }
+    cache_size -= entry.size;
+    cache_lru.pop_back();
+  }
+}
+
+std::shared_ptr<const neam::cr::raw_data> neam::cr::storage::_read_from_file(const std::string &name) const
+{
+  std::shared_ptr<section> sec = _get_section(name);
+  return (sec ? sec->get() : nullptr);
+}
+
 bool neam::cr::storage::_write_to_file(const std::string &name, char *memory, size_t size)
 {
-  if (!mapped_file)
-    mapped_file = new std::map<std::string, raw_data>;
-  mapped_file->erase(name);
-  mapped_file->emplace(name, (raw_data(size, reinterpret_cast<int8_t *>(memory), neam::force_duplicate)));
+  std::map<std::string, batch_operation> operations;
+  batch_operation &op = operations[name];
+  op.remove = false;
+  op.data = raw_data(size, reinterpret_cast<int8_t *>(memory), neam::force_duplicate);
+  return _commit(operations);
+}
 
-  _sync();
+bool neam::cr::storage::_sync()
+{
+  std::lock_guard<std::recursive_mutex> guard(state_lock);
+  std::shared_ptr<const section_index> index = _get_index();
+  if (!index)
+    index = std::make_shared<section_index>();
+
+  std::shared_ptr<section_index> written = std::make_shared<section_index>();
+  if (!_write_all(*index, *written))
+    return false;
+  _publish(std::move(written));
+  dirty = false;
   return true;
 }
 
-void neam::cr::storage::_sync()
+bool neam::cr::storage::_write_all(const section_index &index, section_index &written)
 {
-  if (!mapped_file)
-    mapped_file = new std::map<std::string, raw_data>;
+  if (flags & append_only)
+    return _write_log(index, written);
 
+  memory_allocator mem;
   size_t size = 0;
+  if (!_write_sections(index, mem, size))
+    return false;
+  if (mem.size() != size)
+    abort();
 
-  memory_allocator mem;
-  if (!neam::cr::persistence::serializable<persistence_backend::neam, xor_data<std::map<std::string, raw_data>>>::to_memory(mem, size, mapped_file))
-    return;
+  log_file = false;
+  log_index.clear();
+  log_mapping.reset();
+
+  if (!_replace_file(reinterpret_cast<const char *>(mem.get_contiguous_data()), size))
+    return false;
+
+  // the sections are now read from the new file
+  if (!_map_sections(written))
+  {
+    written = section_index();
+    index.for_each([&written](const std::string &name, const std::shared_ptr<section> &sec)
+    {
+      written.changes.emplace_hint(written.changes.end(), name, sec);
+    });
+  }
+  return true;
+}
+
+bool neam::cr::storage::_replace_file(const char *memory, size_t size)
+{
+  // write a new file, then replace the old one: a crash will leave either the old or the new file
+  // and the sections that are still in the old one (or processes that have mapped it) are not affected
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    internal::file_writer tmp;
+    if (!tmp.open(tmp_filename, true))
+      return false;
+    // the new file must be on the disk before it replaces the old one
+    if (!tmp.write(0, memory, size) || !tmp.sync())
+    {
+      tmp.close();
+      std::remove(tmp_filename.c_str());
+      return false;
+    }
+  }
 
   file.close();
-  file.open(filename, std::ios_base::binary | std::ios_base::in | std::ios_base::out | std::ios_base::trunc);
-  if (file.is_open())
+  bool res = (std::rename(tmp_filename.c_str(), filename.c_str()) == 0);
+  if (!res)
+    std::remove(tmp_filename.c_str());
+  else
+    res = internal::file_writer::sync_directory(filename); // (the rename itself)
+  file.open(filename);
+  return res && file.is_open();
+}
+
+bool neam::cr::storage::_decode_section(const char *file_memory, const section_location &location, raw_data &section)
+{
+  const char *src = file_memory + location.offset;
+  internal::xor_generator gen {xor_seed ^ location.offset};
+  if (location.flags & section_log_record)
+  {
+    // (the hash of the record has been checked when the log was loaded)
+    src += sizeof(log_record_header) + location.name_size;
+    for (uint32_t i = 0; i < location.name_size; ++i)
+      gen();
+  }
+  else if (hash_of(src, location.size) != location.hash)
+    return false;
+
+  int8_t *data = reinterpret_cast<int8_t *>(operator new(location.size, std::nothrow));
+  if (!data && location.size)
+    return false;
+  gen.apply(src, reinterpret_cast<char *>(data), location.size);
+  section.set(location.size, data, neam::assume_ownership);
+
+  if (location.flags & section_compressed)
   {
-    if (mem.size() != size)
-      abort();
-    file.write(reinterpret_cast<const char *>(mem.get_contiguous_data()), size);
-    file.flush();
-    file.sync(); // yay.
+    int8_t *raw = reinterpret_cast<int8_t *>(operator new(location.raw_size, std::nothrow));
+    if (!raw && location.raw_size)
+      return false;
+    raw_data decompressed(location.raw_size, raw, neam::assume_ownership);
+    if (!internal::lz::decompress(reinterpret_cast<const char *>(data), location.size, reinterpret_cast<char *>(raw), location.raw_size))
+      return false;
+    section = std::move(decompressed);
   }
+  return true;
 }
 
-bool neam::cr::storage::_load()
+bool neam::cr::storage::_write_sections(const section_index &index, memory_allocator &mem, size_t &size)
 {
-  if (!file)
+  struct section_job
+  {
+    std::string name;
+    std::shared_ptr<section> sec;
+    bool valid = false;
+    memory_allocator compressed;
+    const char *payload;
+    section_entry entry;
+
+    std::shared_ptr<const raw_data> data; ///< for a section in memory
+
+    // for a section that is copied from the file it is still encoded in
+    std::shared_ptr<const internal::file_mapping> mapping;
+    const section_location *location;
+  };
+
+  std::deque<section_job> jobs; // (memory_allocator can't be moved around by a vector)
+  uint64_t total_size = 0;
+  index.for_each([&](const std::string &name, const std::shared_ptr<section> &sec)
+  {
+    jobs.emplace_back();
+    jobs.back().name = name;
+    jobs.back().sec = sec;
+    total_size += (sec->lazy ? sec->location.raw_size : sec->data.size);
+  });
+
+  // compress the sections in memory (the offsets depend on the compressed sizes)
+  // the sections that are still encoded in a file are copied as they are: only their xor changes with their offset
+  const bool compress = (flags & use_compression);
+  std::atomic<bool> failed(false);
+  internal::parallel_for(jobs.size(), total_size, [&](size_t i)
+  {
+    section_job &job = jobs[i];
+    const uint64_t name_hash = hash_of(job.name.data(), job.name.size());
+    if (job.sec->lazy)
+    {
+      job.mapping = job.sec->mapping;
+      job.location = &job.sec->location;
+      job.payload = job.mapping->data() + job.location->offset;
+      if (job.location->flags & section_log_record)
+        job.payload += sizeof(log_record_header) + job.location->name_size; // (checked when the log was loaded)
+      else if (hash_of(job.payload, job.location->size) != job.location->hash)
+        return;
+      job.entry = section_entry {0, job.location->size, job.location->raw_size, 0, name_hash, 0, uint32_t(job.name.size()), job.location->flags & section_compressed, 0};
+      job.valid = true;
+      return;
+    }
+
+    job.data = job.sec->get();
+    const raw_data *data = job.data.get();
+    if (!data)
+      return;
+    job.valid = true;
+    job.payload = reinterpret_cast<const char *>(data->data);
+    job.entry = section_entry {0, data->size, data->size, 0, name_hash, 0, uint32_t(job.name.size()), 0, 0};
+
+    size_t compressed_size = 0;
+    if (!compress || !data->size)
+      return;
+    if (!internal::lz::compress(job.compressed, compressed_size, job.payload, data->size, 1))
+      failed = true;
+    else if (compressed_size < data->size)
+    {
+      job.payload = reinterpret_cast<const char *>(job.compressed.get_contiguous_data());
+      job.entry.size = compressed_size;
+      job.entry.flags |= section_compressed;
+    }
+  });
+  if (failed)
     return false;
 
-  if (mapped_file)
-    delete mapped_file;
-  mapped_file = nullptr;
+  // the corrupted sections can't be read anyway: they are dropped
+  std::vector<section_job *> valid_jobs;
+  valid_jobs.reserve(jobs.size());
+  uint64_t names_size = 0;
+  for (auto &it : jobs)
+  {
+    if (!it.valid)
+      continue;
+    it.entry.name_offset = names_size;
+    names_size += it.name.size();
+    valid_jobs.push_back(&it);
+  }
+  if (names_size > 0xFFFFFFFF || valid_jobs.size() >= 0xFFFFFFFF)
+    return false;
 
-  file.sync();
-  file.seekg(0, std::ios_base::end);
-  size_t size = file.tellg();
-  file.seekg(0, std::ios_base::beg);
+  // layout the file
+  const uint64_t bucket_count = bucket_count_for(valid_jobs.size());
+  const uint64_t buckets_offset = sizeof(section_file_header);
+  const uint64_t entries_offset = buckets_offset + bucket_count * sizeof(uint32_t);
+  const uint64_t names_offset = entries_offset + valid_jobs.size() * sizeof(section_entry);
+  const uint64_t table_size = names_offset + names_size - buckets_offset;
+  uint64_t offset = section_align(names_offset + names_size);
+  total_size = 0;
+  for (section_job *it : valid_jobs)
+  {
+    it->entry.offset = offset;
+    offset = section_align(offset + it->entry.size);
+    total_size += it->entry.size;
+  }
 
-  if (!size)
+  char *memory = reinterpret_cast<char *>(mem.allocate(offset));
+  if (!memory)
     return false;
+  memset(memory, 0, offset);
 
-  char *memory = new char[size];
+  // xor the sections in place
+  internal::parallel_for(valid_jobs.size(), total_size, [&](size_t i)
+  {
+    section_job &job = *valid_jobs[i];
+    char *dest = memory + job.entry.offset;
+    if (job.mapping)
+    {
+      // remove the xor of the old offset (after the name, for a log record), then apply the one of the new offset
+      internal::xor_generator gen {xor_seed ^ job.location->offset};
+      if (job.location->flags & section_log_record)
+      {
+        for (uint32_t j = 0; j < job.location->name_size; ++j)
+          gen();
+      }
+      gen.apply(job.payload, dest, job.entry.size);
+      internal::xor_generator {xor_seed ^ job.entry.offset}.apply(dest, job.entry.size);
+    }
+    else
+      internal::xor_generator {xor_seed ^ job.entry.offset}.apply(job.payload, dest, job.entry.size);
+    job.entry.hash = hash_of(dest, job.entry.size);
+  });
 
-  file.read(memory, size);
-  cr::allocation_transaction transaction;
-  if (!neam::cr::persistence::serializable<persistence_backend::neam, xor_data<std::map<std::string, raw_data> *>>::from_memory(transaction, memory, size, &mapped_file))
+  // the table
+  const uint64_t mask = bucket_count - 1;
+  for (size_t i = 0; i < valid_jobs.size(); ++i)
   {
-    mapped_file = nullptr;
-    transaction.rollback();
-    delete [] memory;
+    section_job &job = *valid_jobs[i];
+    job.entry.check = entry_check(job.entry, job.name.data());
+
+    const uint64_t entry_offset = entries_offset + i * sizeof(section_entry);
+    internal::xor_generator {xor_seed ^ entry_offset}.apply(reinterpret_cast<const char *>(&job.entry), memory + entry_offset, sizeof(section_entry));
+    const uint64_t name_offset = names_offset + job.entry.name_offset;
+    internal::xor_generator {xor_seed ^ name_offset}.apply(job.name.data(), memory + name_offset, job.name.size());
+
+    uint64_t bucket = job.entry.name_hash & mask;
+    uint32_t entry_index;
+    for (;; bucket = (bucket + 1) & mask)
+    {
+      memcpy(&entry_index, memory + buckets_offset + bucket * sizeof(uint32_t), sizeof(entry_index));
+      if (!entry_index)
+        break;
+    }
+    entry_index = i + 1;
+    memcpy(memory + buckets_offset + bucket * sizeof(uint32_t), &entry_index, sizeof(entry_index));
+  }
+
+  section_file_header header {section_magic, section_version, valid_jobs.size(), bucket_count, table_size};
+  memcpy(memory, &header, sizeof(header));
+
+  size = offset;
+  return true;
+}
+
+bool neam::cr::storage::_load_sections(const std::shared_ptr<const internal::file_mapping> &mapping, section_index &index)
+{
+  const char *memory = mapping->data();
+  const uint64_t size = mapping->get_size();
+
+  // only the header is read: the table is used directly from the file
+  section_file_header header;
+  if (size < sizeof(header))
+    return false;
+  memcpy(&header, memory, sizeof(header));
+  if (header.magic != section_magic || header.version != section_version)
+    return false;
+  if (header.table_size > size - sizeof(header) || header.bucket_count > size || header.section_count > size)
     return false;
+  if (!header.bucket_count || (header.bucket_count & (header.bucket_count - 1)) || header.bucket_count <= header.section_count)
+    return false;
+  const uint64_t fixed_size = header.bucket_count * sizeof(uint32_t) + header.section_count * sizeof(section_entry);
+  if (fixed_size > header.table_size)
+    return false;
+
+  index.table.mapping = mapping;
+  index.table.entry_count = header.section_count;
+  index.table.bucket_count = header.bucket_count;
+  index.table.buckets_offset = sizeof(header);
+  index.table.entries_offset = index.table.buckets_offset + header.bucket_count * sizeof(uint32_t);
+  index.table.names_offset = index.table.entries_offset + header.section_count * sizeof(section_entry);
+  index.table.names_size = header.table_size - fixed_size;
+  return true;
+}
+
+bool neam::cr::storage::_map_sections(section_index &index)
+{
+  std::shared_ptr<internal::file_mapping> mapping = std::make_shared<internal::file_mapping>();
+  if (!mapping->open(filename))
+    return false;
+  index = section_index();
+  return _load_sections(mapping, index);
+}
+
+bool neam::cr::storage::_append_records(section_index &index, const log_operation *operations, size_t count)
+{
+  // the file has first to be turned into a log (this also writes the new records)
+  if (!log_file)
+  {
+    section_index written;
+    if (!_write_log(index, written))
+      return false;
+    index = std::move(written);
+    return true;
   }
 
-  transaction.complete();
+  // all the records but the last one are flagged: they are only applied if the last one is in the file
+  memory_allocator mem;
+  std::vector<uint64_t> record_sizes(count);
+  uint64_t offset = log_size;
+  for (size_t i = 0; i < count; ++i)
+  {
+    const uint32_t type = operations[i].type | (i + 1 < count ? static_cast<uint32_t>(record_batched) : 0u);
+    record_sizes[i] = encode_record(mem, offset, type, *operations[i].name, operations[i].data, flags & use_compression);
+    if (!record_sizes[i])
+      return false;
+    offset += record_sizes[i];
+  }
 
-  delete [] memory;
+  // the records are only applied (and the commit only succeeds) once they are on the disk
+  if (!file.write(log_size, reinterpret_cast<const char *>(mem.get_contiguous_data()), offset - log_size) || !file.sync())
+  {
+    // we don't know what has been written: the file will be rewritten
+    log_file = false;
+    dirty = true;
+    return false;
+  }
+
+  const uint64_t first_offset = log_size;
+  for (size_t i = 0; i < count; ++i)
+  {
+    auto it = log_index.find(*operations[i].name);
+    if (it != log_index.end())
+    {
+      log_live_size -= it->second.size;
+      log_index.erase(it);
+    }
+    if ((operations[i].type & record_type_mask) == record_write)
+    {
+      log_index.emplace(*operations[i].name, log_entry {log_size, record_sizes[i]});
+      log_live_size += record_sizes[i];
+    }
+    log_size += record_sizes[i];
+  }
+
+  // the dead records take more room than the live ones
+  // (a failed compaction is not an error: the records are in the file anyway)
+  if (log_size > log_compaction_threshold && log_size - sizeof(log_file_header) > 2 * log_live_size)
+  {
+    section_index written;
+    if (_write_log(index, written))
+    {
+      index = std::move(written);
+      return true;
+    }
+  }
+
+  // the written sections are read back from the log: a long running storage doesn't keep all its writes in memory
+  if (_map_log(log_size, false))
+  {
+    const char *memory = reinterpret_cast<const char *>(mem.get_contiguous_data());
+    uint64_t offset = first_offset;
+    for (size_t i = 0; i < count; ++i)
+    {
+      if ((operations[i].type & record_type_mask) == record_write)
+        index.changes[*operations[i].name] = _record_section(log_mapping, memory + (offset - first_offset), offset, operations[i].data->size);
+      offset += record_sizes[i];
+    }
+  }
+  return true;
+}
+
+bool neam::cr::storage::_map_log(uint64_t end, bool remap)
+{
+  if (!remap && log_mapping && log_mapping->covers(end))
+    return true;
+  log_mapping.reset();
+  // (without mmap, the whole file would be read again after each append)
+  if (!remap && !internal::file_mapping::sees_appends)
+    return false;
+
+  // the mapping has room for the log to double: it isn't mapped again at each append
+  std::shared_ptr<internal::file_mapping> mapping = std::make_shared<internal::file_mapping>();
+  const uint64_t reserve = (end > log_compaction_threshold ? 2 * end : 2 * log_compaction_threshold);
+  if (reserve > std::numeric_limits<size_t>::max() || !mapping->open(filename, reserve) || !mapping->covers(end) || mapping->get_size() < end)
+    return false;
+  log_mapping = std::move(mapping);
+  return true;
+}
+
+std::shared_ptr<neam::cr::storage::section> neam::cr::storage::_record_section(const std::shared_ptr<const internal::file_mapping> &mapping, const char *record, uint64_t offset, uint64_t raw_size)
+{
+  log_record_header header;
+  memcpy(&header, record, sizeof(header));
+  section_location location {offset, header.data_size, raw_size, header.hash, section_log_record, header.name_size};
+  if (header.type & record_compressed)
+    location.flags |= section_compressed;
+  return std::make_shared<section>(mapping, location);
+}
+
+bool neam::cr::storage::_commit(std::map<std::string, batch_operation> &operations)
+{
+  if (operations.empty())
+    return true;
+
+  if (!_uses_committer())
+    return _apply_operations(operations);
+
+  // give the operations to the committer thread and wait for it
+  return _commit_async(operations, true, false).get();
+}
+
+std::future<bool> neam::cr::storage::_commit_async(std::map<std::string, batch_operation> &operations, bool valid, bool sync)
+{
+  commit_request *request = new commit_request;
+  std::future<bool> ret = request->result.get_future();
+  if (!valid || (operations.empty() && !sync))
+  {
+    request->result.set_value(valid);
+    delete request;
+    return ret;
+  }
+  request->operations.swap(operations);
+  request->sync = sync;
+
+  std::lock_guard<std::mutex> guard(queue_lock);
+  if (!committer.joinable())
+    committer = std::thread(&storage::_committer_loop, this);
+  commit_queue.push_back(request);
+  queue_condition.notify_one();
+  return ret;
+}
 
-  return !!mapped_file;
+bool neam::cr::storage::_uses_committer() const
+{
+  return (flags & thread_safe) || committer.joinable();
+}
+
+std::future<bool> neam::cr::storage::sync_async()
+{
+  std::map<std::string, batch_operation> operations;
+  return _commit_async(operations, true, true);
+}
+
+void neam::cr::storage::_committer_loop()
+{
+  std::unique_lock<std::mutex> lock(queue_lock);
+  while (true)
+  {
+    queue_condition.wait(lock, [this]() { return stop_committer || !commit_queue.empty(); });
+    if (commit_queue.empty())
+      return;
+
+    // take every request that is waiting: they will share the same sync
+    std::vector<commit_request *> requests;
+    requests.swap(commit_queue);
+    lock.unlock();
+    internal::thread_activity::scope activity;
+
+    std::map<std::string, batch_operation> operations;
+    bool sync = false;
+    for (commit_request *request : requests)
+    {
+      for (auto &it : request->operations)
+      {
+        batch_operation &op = operations[it.first];
+        op.remove = it.second.remove;
+        op.data = std::move(it.second.data);
+      }
+      sync |= request->sync;
+    }
+
+    // (the file is fsynced by _apply_operations() and _sync(): a future only becomes true once its writes are on the disk)
+    bool result = _apply_operations(operations);
+    if (result && sync)
+    {
+      std::lock_guard<std::recursive_mutex> guard(state_lock);
+      if (dirty)
+        result = _sync();
+    }
+
+    for (commit_request *request : requests)
+    {
+      request->result.set_value(result);
+      delete request;
+    }
+    lock.lock();
+  }
+}
+
+bool neam::cr::storage::_apply_operations(std::map<std::string, batch_operation> &operations)
+{
+  std::lock_guard<std::recursive_mutex> guard(state_lock);
+  if (operations.empty())
+    return true;
+
+  // build the next version of the index (readers still see the current one)
+  std::shared_ptr<const section_index> index = _get_index();
+  std::shared_ptr<section_index> next = (index ? std::make_shared<section_index>(*index) : std::make_shared<section_index>());
+
+  std::vector<log_operation> log_operations;
+  log_operations.reserve(operations.size());
+  for (auto &it : operations)
+  {
+    if (it.second.remove)
+    {
+      next->remove(it.first);
+      log_operations.push_back(log_operation {record_remove, &it.first, nullptr});
+    }
+    else
+    {
+      std::shared_ptr<section> sec = std::make_shared<section>(raw_data(it.second.data, neam::stole_ownership));
+      next->changes[it.first] = sec;
+      log_operations.push_back(log_operation {record_write, &it.first, &sec->data});
+    }
+  }
+
+  bool res;
+  std::shared_ptr<section_index> written = next;
+  if (flags & append_only)
+    res = _append_records(*next, log_operations.data(), log_operations.size());
+  else
+    res = _write_all(*next, *(written = std::make_shared<section_index>()));
+
+  if (!res)
+  {
+    // the batch gets its data back (the new sections have never been published)
+    for (auto &it : operations)
+    {
+      if (!it.second.remove)
+        it.second.data.stole_ownership(next->changes[it.first]->data);
+    }
+    return false;
+  }
+
+  _publish(std::move(written));
+  for (auto &it : operations)
+    _cache_invalidate(&it.first);
+  operations.clear();
+  dirty = false;
+  return true;
+}
+
+bool neam::cr::storage::_write_log(const section_index &index, section_index &written)
+{
+  memory_allocator mem;
+  log_file_header *header = reinterpret_cast<log_file_header *>(mem.allocate(sizeof(log_file_header)));
+  if (!header)
+    return false;
+  header->magic = log_magic;
+  header->version = log_version;
+
+  std::map<std::string, log_entry> new_log_index;
+  std::vector<uint64_t> raw_sizes; // (in the order of new_log_index)
+  uint64_t size = sizeof(log_file_header);
+  bool failed = false;
+  index.for_each([&](const std::string &name, const std::shared_ptr<section> &sec)
+  {
+    // the corrupted sections can't be read anyway: they are dropped
+    if (failed)
+      return;
+    const std::shared_ptr<const raw_data> data = sec->get();
+    if (!data)
+      return;
+    const uint64_t record_size = encode_record(mem, size, record_write, name, data.get(), flags & use_compression);
+    if (!record_size)
+    {
+      failed = true;
+      return;
+    }
+    new_log_index.emplace_hint(new_log_index.end(), name, log_entry {size, record_size});
+    raw_sizes.push_back(data->size);
+    size += record_size;
+  });
+  if (failed || mem.has_failed() || mem.size() != size)
+    return false;
+
+  if (!_replace_file(reinterpret_cast<const char *>(mem.get_contiguous_data()), size))
+  {
+    log_file = false;
+    return false;
+  }
+
+  log_index.swap(new_log_index);
+  log_size = size;
+  log_live_size = size - sizeof(log_file_header);
+  log_file = true;
+
+  // the sections are now read from the new log
+  written = section_index();
+  if (_map_log(size, true))
+  {
+    const char *memory = reinterpret_cast<const char *>(mem.get_contiguous_data());
+    size_t i = 0;
+    for (auto &it : log_index)
+      written.changes.emplace_hint(written.changes.end(), it.first, _record_section(log_mapping, memory + it.second.offset, it.second.offset, raw_sizes[i++]));
+  }
+  else
+  {
+    index.for_each([&written](const std::string &name, const std::shared_ptr<section> &sec)
+    {
+      written.changes.emplace_hint(written.changes.end(), name, sec);
+    });
+  }
+  return true;
+}
+
+bool neam::cr::storage::_load_log(const std::shared_ptr<const internal::file_mapping> &mapping, section_index &index)
+{
+  const char *memory = mapping->data();
+  const uint64_t size = mapping->get_size();
+
+  log_file_header header;
+  if (size < sizeof(header))
+    return false;
+  memcpy(&header, memory, sizeof(header));
+  if (header.magic != log_magic || header.version != log_version)
+    return false;
+
+  // records of a batch are only applied once its last record has been read
+  struct pending_record
+  {
+    std::string name;
+    uint32_t type;
+    section_location location;
+    uint64_t size;
+  };
+  std::vector<pending_record> pending;
+
+  uint64_t offset = sizeof(log_file_header);
+  uint64_t end_offset = offset; // the end of the last complete batch
+  while (size - offset >= sizeof(log_record_header))
+  {
+    log_record_header record;
+    memcpy(&record, memory + offset, sizeof(record));
+
+    // a torn / corrupted record: the log ends here
+    const uint64_t body_size = uint64_t(record.name_size) + record.data_size;
+    if (record.data_size > size || body_size > size - offset - sizeof(record))
+      break;
+    const char *body = memory + offset + sizeof(record);
+    if (record_hash(record, body) != record.hash)
+      break;
+    const uint32_t type = record.type & record_type_mask;
+    if (type != record_write && type != record_remove)
+      break;
+
+    // only the name is decoded: the data stays in the file until the section is read
+    neam::cr::internal::xor_generator gen {xor_seed ^ offset};
+    std::string name(record.name_size, '\0');
+    gen.apply(body, &name[0], record.name_size);
+
+    section_location location {offset, record.data_size, record.data_size, record.hash, section_log_record, record.name_size};
+    if (type == record_write && (record.type & record_compressed))
+    {
+      char frame[sizeof(internal::lz::frame_header)];
+      const size_t frame_size = (record.data_size < sizeof(frame) ? record.data_size : sizeof(frame));
+      gen.apply(body + record.name_size, frame, frame_size);
+      size_t raw_size = 0;
+      if (!internal::lz::get_raw_size(frame, frame_size, raw_size))
+        break;
+      location.raw_size = raw_size;
+      location.flags |= section_compressed;
+    }
+    pending.push_back(pending_record {std::move(name), type, location, sizeof(record) + body_size});
+    offset += sizeof(record) + body_size;
+
+    if (record.type & record_batched)
+      continue;
+
+    for (pending_record &it : pending)
+    {
+      auto index_it = log_index.find(it.name);
+      if (index_it != log_index.end())
+      {
+        log_live_size -= index_it->second.size;
+        log_index.erase(index_it);
+      }
+      index.changes.erase(it.name);
+
+      if (it.type == record_write)
+      {
+        index.changes.emplace(it.name, std::make_shared<section>(mapping, it.location));
+        log_index.emplace(it.name, log_entry {it.location.offset, it.size});
+        log_live_size += it.size;
+      }
+    }
+    pending.clear();
+    end_offset = offset;
+  }
+
+  log_size = end_offset;
+  // the end of the file is garbage (or an incomplete batch): the next write will rewrite the whole log
+  log_file = (end_offset == size);
+  return true;
+}
+
+bool neam::cr::storage::_load()
+{
+  std::lock_guard<std::recursive_mutex> guard(state_lock);
+  _publish(nullptr);
+  _cache_invalidate(nullptr);
+  log_index.clear();
+  log_size = 0;
+  log_live_size = 0;
+  log_file = false;
+  log_mapping.reset();
+  dirty = false;
+
+  if (!file.is_open())
+    return false;
+
+  std::shared_ptr<internal::file_mapping> mapping = std::make_shared<internal::file_mapping>();
+  if (!mapping->open(filename))
+    return false;
+
+  const char *memory = mapping->data();
+  const size_t size = mapping->get_size();
+
+  std::shared_ptr<section_index> index = std::make_shared<section_index>();
+  if (_load_sections(mapping, *index))
+  {
+    _publish(std::move(index));
+    return true;
+  }
+  if (_load_log(mapping, *index))
+  {
+    log_mapping = mapping;
+    _publish(std::move(index));
+    return true;
+  }
+
+  // a file written by a previous version
+  using map_t = std::map<std::string, raw_data>;
+
+  // the file may or may not be compressed: try the one we would write first
+  const bool compressed_first = (flags & use_compression);
+  map_t *legacy_map = nullptr;
+  bool res = false;
+  for (size_t i = 0; i < 2 && !res; ++i)
+  {
+    cr::allocation_transaction transaction;
+    legacy_map = nullptr;
+    if (compressed_first == (i == 0))
+      res = neam::cr::persistence::serializable<persistence_backend::neam, xor_data<compressed<map_t *>>>::from_memory(transaction, memory, size, reinterpret_cast<compressed<map_t *> *>(&legacy_map));
+    else
+      res = neam::cr::persistence::serializable<persistence_backend::neam, xor_data<map_t *>>::from_memory(transaction, memory, size, &legacy_map);
+
+    if (res)
+      transaction.complete();
+    else
+      transaction.rollback();
+  }
+  if (!res || !legacy_map)
+    return false;
+
+  for (auto &it : *legacy_map)
+    index->changes.emplace_hint(index->changes.end(), it.first, std::make_shared<section>(raw_data(it.second, neam::stole_ownership)));
+  delete legacy_map;
+
+  _publish(std::move(index));
+  return true;
 }
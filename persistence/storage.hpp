@@ -32,8 +32,17 @@
 
 #include <string>
 #include <map>
-#include <fstream>
+#include <list>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <vector>
+#include <memory>
 #include "object.hpp"
+#include "file_mapping.hpp"
+#include "file_writer.hpp"
 
 namespace neam
 {
@@ -42,10 +51,24 @@ namespace neam
     /// \brief this is a \e reflective storage file (or whatever)
     /// it provide a way to serialize / deserialize information from objects directly to a file
     /// \note a file can contains multiple objects (they are named)
+    /// \note reads (contains(), load_from_file()) work on a snapshot of the storage and never wait for a write to complete
     class storage
     {
       public:
-        storage(const std::string &filename);
+        /// \brief flags that change how the file is written (a file is always readable, whatever the flags)
+        enum flags : uint32_t
+        {
+          none = 0,
+          use_compression = 1 << 0, ///< compress the sections (with the codec of the \e compressed wrapper)
+          append_only = 1 << 1,     ///< writes and removes append a record to the file instead of rewriting it (see storage::compact())
+          thread_safe = 1 << 2,     ///< the storage can be used from multiple threads. Writes are queued and committed together by a committer thread (group commit)
+        };
+
+        class batch;
+        class section_handle;
+
+      public:
+        storage(const std::string &filename, uint32_t flags = none);
         ~storage();
 
         /// \brief return the filename
@@ -63,12 +86,100 @@ namespace neam
         /// \brief test whether or not if the storage object contains the object with the name \e name
         bool contains(const std::string &name) const;
 
+        /// \brief return the sections whose name starts with \e prefix, in the order of their names
+        /// \note no section is decoded: the handles load them on demand
+        std::vector<section_handle> list_sections(const std::string &prefix = std::string()) const;
+
+        /// \brief return the sections whose name is in [\e first, \e last), in the order of their names (an empty \e last means no upper bound)
+        std::vector<section_handle> list_sections(const std::string &first, const std::string &last) const;
+
         /// \brief remove a section from the file
         void remove(const std::string &name);
 
+        /// \brief rewrite the file with only the live sections
+        /// \note for \e append_only storages, this drops the overwritten and removed records (this is also done automatically when they take more room than the live ones)
+        bool compact();
+
         /// \brief write the object to the file
         template<typename Object>
         bool write_to_file(const std::string &name, const Object &obj)
+        {
+          // the serialized data is given to the storage (it isn't copied)
+          std::map<std::string, batch_operation> operations;
+          batch_operation &op = operations[name];
+          op.remove = false;
+          if (!_serialize(obj, op.data))
+            return false;
+          return _commit(operations);
+        }
+
+        /// \brief write the object to the file without waiting for the disk
+        /// The object is serialized now, then written (and synced) by the committer thread, with the other pending writes
+        /// \return a future that becomes \b true once the object is in the file
+        /// \note once an async write has been made, all the writes of the storage go through the committer thread (so they stay in order)
+        template<typename Object>
+        std::future<bool> write_to_file_async(const std::string &name, const Object &obj)
+        {
+          std::map<std::string, batch_operation> operations;
+          batch_operation &op = operations[name];
+          op.remove = false;
+          const bool valid = _serialize(obj, op.data);
+          return _commit_async(operations, valid, false);
+        }
+
+        /// \brief sync the changes in memory (the removed sections) with the file, without waiting for the disk
+        std::future<bool> sync_async();
+
+        template<typename Object>
+        Object *load_from_file(const std::string &name)
+        {
+          return _load_section<Object>(_get_section(name));
+        }
+
+        /// \brief load an object through the object cache (see set_cache_size())
+        /// Repeated loads of the same section with the same type return the same (immutable) instance,
+        /// until the section is written or removed
+        /// \return nullptr if there's no such section or if it can't be deserialized
+        template<typename Object>
+        std::shared_ptr<const Object> load_shared(const std::string &name)
+        {
+          const void *type = _type_key<Object>();
+          uint64_t generation;
+          std::shared_ptr<const void> cached;
+          if (_cache_find(name, type, cached, generation))
+            return std::static_pointer_cast<const Object>(cached);
+
+          std::shared_ptr<section> sec = _get_section(name);
+          std::shared_ptr<const Object> ret(_load_section<Object>(sec));
+          if (ret)
+            _cache_insert(name, type, ret, sec->get_size() + sizeof(Object), generation);
+          return ret;
+        }
+
+        /// \brief set the size of the object cache used by load_shared(), in bytes (0, the default, disables it)
+        /// \note the size of an object is estimated as its serialized size plus sizeof(Object)
+        void set_cache_size(uint64_t max_size);
+
+        /// \brief write serialized data to the file
+        bool _write_to_file(const std::string &name, char *memory, size_t size);
+
+        /// \brief return the data from a named section of the file (nullptr if there's none, or if it is corrupted)
+        /// \note the data stays valid while it is held (even if the section is written or removed in the meantime).
+        ///       The storage doesn't keep it: a section that is still in the file is decoded at each call.
+        std::shared_ptr<const raw_data> _read_from_file(const std::string &name) const;
+
+        /// \brief sync the changes in memory with the file (the whole file is rewritten)
+        bool _sync();
+
+        /// \brief (re) load the file
+        bool _load();
+
+      private:
+        struct section;
+
+        /// \brief serialize an object, \e data takes the ownership of the memory the serializer produced
+        template<typename Object>
+        static bool _serialize(const Object &obj, raw_data &data)
         {
           size_t size = 0;
 
@@ -76,17 +187,23 @@ namespace neam
           if (!neam::cr::persistence::serializable<persistence_backend::neam, checksum<Object>>::to_memory(mem, size, const_cast<Object *>(&obj)))
             return false;
 
-          return _write_to_file(name, reinterpret_cast<char *>(mem.get_contiguous_data()), size);
+          int8_t *memory = reinterpret_cast<int8_t *>(mem.give_up_data());
+          if (!memory && size)
+            return false;
+          data.set(size, memory, neam::assume_ownership);
+          return true;
         }
 
+        /// \brief deserialize a section (nullptr if it is corrupted or if the object can't be deserialized)
+        /// \note the section stays alive while it's used, even if it is replaced in the meantime
         template<typename Object>
-        Object *load_from_file(const std::string &name)
+        static Object *_load_section(const std::shared_ptr<section> &sec)
         {
-          char *memory = nullptr;
-          size_t size = 0;
-
-          if (!_read_from_file(name, memory, size))
+          const std::shared_ptr<const raw_data> data = (sec ? sec->get() : nullptr);
+          if (!data)
             return nullptr;
+          const char *memory = reinterpret_cast<const char *>(data->data);
+          const size_t size = data->size;
 
           cr::allocation_transaction transaction;
           Object *ret = reinterpret_cast<Object *>(transaction.allocate_raw(sizeof(Object)));
@@ -103,23 +220,365 @@ namespace neam
           return ret;
         }
 
-        /// \brief write serialized data to the file
-        bool _write_to_file(const std::string &name, char *memory, size_t size);
+        /// \brief where a section that has not been read yet is in the (mapped) file
+        /// (in a section table, or in a record of a log file)
+        struct section_location
+        {
+          uint64_t offset;
+          uint64_t size;
+          uint64_t raw_size;
+          uint64_t hash;
+          uint32_t flags;
+          uint32_t name_size; ///< for a log record: the size of the name that is before the data
+        };
 
-        /// \brief return the data from a named section of the file
-        bool _read_from_file(const std::string &name, char *&memory, size_t &size);
+        /// \brief a section of the storage. Once in an index, a section is never modified
+        struct section : public std::enable_shared_from_this<section>
+        {
+          /// \brief a section in memory
+          explicit section(raw_data &&_data) : data(std::move(_data)) {}
 
-        /// \brief sync the changes in memory with the file
-        void _sync();
+          /// \brief a section that is still in the file: it is decoded each time it is read
+          section(std::shared_ptr<const internal::file_mapping> _mapping, const section_location &_location)
+            : lazy(true), mapping(std::move(_mapping)), location(_location) {}
 
-        /// \brief (re) load the file
-        bool _load();
+          /// \brief return the data of the section, nullptr if it is corrupted
+          /// \note the decoded data of a section that is still in the file is not kept: it lives as long as the returned pointer
+          std::shared_ptr<const raw_data> get() const;
+
+          /// \brief return the size of the (decoded) data
+          uint64_t get_size() const;
+
+          raw_data data; ///< (for a section in memory)
+          const bool lazy = false;
+
+          std::shared_ptr<const internal::file_mapping> mapping; ///< the mapped file a lazy section is encoded in
+          section_location location;
+        };
+
+        /// \brief the section table of a file written by _write_sections(), used directly from the mapped file
+        struct section_table
+        {
+          std::shared_ptr<const internal::file_mapping> mapping; ///< nullptr if there's no table
+          uint64_t entry_count = 0;
+          uint64_t bucket_count = 0;
+          uint64_t buckets_offset = 0;
+          uint64_t entries_offset = 0;
+          uint64_t names_offset = 0;
+          uint64_t names_size = 0;
+
+          /// \brief return the index of the first entry whose name is not less than \e name
+          uint64_t lower_bound(const std::string &name) const;
+
+          /// \brief probe the hash table for the entry of \e name
+          bool find(const std::string &name, section_location &location) const;
+
+          /// \brief read an entry (false if it is corrupted)
+          bool get_entry(uint64_t index, std::string *name, section_location &location) const;
+
+          /// \brief create the (lazy) section of an entry
+          std::shared_ptr<section> get_section(const section_location &location) const;
+        };
+
+        /// \brief the index of the sections: the table of the file, plus what has changed since it has been loaded.
+        /// An index is immutable once published: writers publish new versions
+        struct section_index
+        {
+          section_table table;
+          std::map<std::string, std::shared_ptr<section>> changes; ///< written (or removed: nullptr) sections
+
+          /// \brief return a section, nullptr if there is none with that name
+          std::shared_ptr<section> find(const std::string &name) const;
+
+          /// \brief remove a section (only the ones of the table have to be remembered)
+          void remove(const std::string &name);
+
+          /// \brief call func(name, section) for every section, in the order of the names
+          template<typename Func>
+          void for_each(Func &&func) const;
+
+          /// \brief call func(name, section) for the sections in [first, last) (an empty \e last means no upper bound)
+          template<typename Func>
+          void for_each(const std::string &first, const std::string &last, Func &&func) const;
+        };
+
+        /// \brief an operation of a batch
+        struct batch_operation
+        {
+          bool remove;
+          raw_data data;
+        };
+
+        /// \brief an operation to append to the log
+        struct log_operation
+        {
+          uint32_t type;
+          const std::string *name;
+          const raw_data *data;
+        };
+
+        /// \brief return the current version of the index (a snapshot: it won't change)
+        std::shared_ptr<const section_index> _get_index() const;
+
+        /// \brief make \e index the current version of the index
+        void _publish(std::shared_ptr<const section_index> index);
+
+        /// \brief return a section of the current index
+        std::shared_ptr<section> _get_section(const std::string &name) const;
+
+        /// \brief apply the operations with a single sync (for thread_safe storages, they are given to the committer thread)
+        bool _commit(std::map<std::string, batch_operation> &operations);
+
+        /// \brief give the operations to the committer thread (started if needed) and return without waiting for them
+        /// \param valid if false, the returned future is already \b false (and nothing is queued)
+        /// \param sync if true, the committer thread also syncs the changes that are only in memory
+        std::future<bool> _commit_async(std::map<std::string, batch_operation> &operations, bool valid, bool sync);
+
+        /// \brief true if the writes have to go through the committer thread
+        bool _uses_committer() const;
+
+        /// \brief an object of the cache
+        struct cache_entry
+        {
+          std::string name;
+          const void *type;
+          std::shared_ptr<const void> object;
+          uint64_t size;
+        };
+
+        /// \brief return a key that is unique to a type
+        template<typename Object>
+        static const void *_type_key()
+        {
+          static const char key = 0;
+          return &key;
+        }
+
+        /// \brief look for an object in the cache
+        /// \param[out] generation to give to _cache_insert() (so an object loaded before an invalidation is not inserted)
+        bool _cache_find(const std::string &name, const void *type, std::shared_ptr<const void> &object, uint64_t &generation);
+
+        /// \brief insert an object in the cache (if the cache hasn't been invalidated since \e generation)
+        void _cache_insert(const std::string &name, const void *type, std::shared_ptr<const void> object, uint64_t size, uint64_t generation);
+
+        /// \brief drop the cached objects of a section (of every section if \e name is nullptr)
+        /// \note must be called after the new index has been published
+        void _cache_invalidate(const std::string *name);
+
+        /// \brief drop the least recently used objects until the cache fits in \e cache_max_size
+        void _cache_evict();
+
+        /// \brief apply the operations with a single sync. On failure, nothing is changed.
+        /// \note on success, \e operations is cleared (the sections are moved to the storage)
+        bool _apply_operations(std::map<std::string, batch_operation> &operations);
+
+        /// \brief the operations of a writer, waiting for the committer thread (that deletes the request once it is done)
+        struct commit_request
+        {
+          std::map<std::string, batch_operation> operations;
+          bool sync = false;
+          std::promise<bool> result;
+        };
+
+        /// \brief the committer thread: it applies all the waiting requests with a single sync
+        void _committer_loop();
+
+        /// \brief rewrite the whole file with the content of \e index
+        /// \param[out] written the index of the new file
+        bool _write_all(const section_index &index, section_index &written);
+
+        /// \brief serialize the whole storage (the sections are encoded in parallel)
+        bool _write_sections(const section_index &index, memory_allocator &mem, size_t &size);
+
+        /// \brief build the index from a file written by _write_sections()
+        /// \note the sections are only decoded when they are read
+        bool _load_sections(const std::shared_ptr<const internal::file_mapping> &mapping, section_index &index);
+
+        /// \brief map the file and build its index (after it has been rewritten)
+        bool _map_sections(section_index &index);
+
+        /// \brief check and decode a section of the mapped file
+        static bool _decode_section(const char *file_memory, const section_location &location, raw_data &section);
+
+        /// \brief replace the file by a new one, with the content of \e memory
+        bool _replace_file(const char *memory, size_t size);
+
+        /// \brief append some records at once, they will be applied all together or not at all when loading the log
+        /// \param index the index, once the records are applied. On success, its written sections are replaced by the ones of the log
+        ///              (so their data isn't kept in memory: it is read back from the file)
+        bool _append_records(section_index &index, const log_operation *operations, size_t count);
+
+        /// \brief rewrite the whole log, with only the live sections
+        /// \param[out] written the index of the new log (its sections are read from the file)
+        bool _write_log(const section_index &index, section_index &written);
+
+        /// \brief make log_mapping cover the first \e end bytes of the log (it is mapped again if needed, with room to grow)
+        /// \param remap map the file even if the current mapping covers it (once the file has been replaced)
+        /// \return false if the log can't be read through a mapping (the sections are then kept in memory)
+        bool _map_log(uint64_t end, bool remap);
+
+        /// \brief create the (lazy) section of a record that has been written to the log
+        /// \param record the record, as it has been written at \e offset
+        /// \param raw_size the size of the data of the section (before compression)
+        static std::shared_ptr<section> _record_section(const std::shared_ptr<const internal::file_mapping> &mapping, const char *record, uint64_t offset, uint64_t raw_size);
+
+        /// \brief build the index from the records of a log file
+        /// \note the records are checked, but they are only decoded when they are read
+        bool _load_log(const std::shared_ptr<const internal::file_mapping> &mapping, section_index &index);
 
       private:
-        std::map<std::string, raw_data> *mapped_file;
-        std::fstream file;
+        /// \brief where the live record of a section is in the log
+        struct log_entry
+        {
+          uint64_t offset;
+          uint64_t size;
+        };
+
+        /// \brief the current version of the index (nullptr if the storage isn't valid).
+        /// Readers take it with std::atomic_load() and keep it alive for as long as they need it.
+        std::shared_ptr<const section_index> sections;
+
+        internal::file_writer file;
         std::string filename;
+        uint32_t flags;
+        bool dirty = false; ///< true if the file is not up to date
+
+        // log state (for append_only storages)
+        std::map<std::string, log_entry> log_index;
+        uint64_t log_size = 0;      ///< where the next record will be appended
+        uint64_t log_live_size = 0; ///< the size taken by the live records
+        bool log_file = false;      ///< true if the file is a log that ends at log_size
+        std::shared_ptr<const internal::file_mapping> log_mapping; ///< the written sections are read from it (it has room for the next records)
+
+        /// \brief serializes the writers (readers never take it)
+        mutable std::recursive_mutex state_lock;
+
+        // group commit (for thread_safe storages)
+        std::thread committer;
+        std::mutex queue_lock;
+        std::condition_variable queue_condition; ///< signaled when a request is queued
+        std::vector<commit_request *> commit_queue;
+        bool stop_committer = false;
+
+        // object cache (for load_shared())
+        std::mutex cache_lock;
+        std::list<cache_entry> cache_lru; ///< the most recently used objects first
+        std::unordered_multimap<std::string, std::list<cache_entry>::iterator> cache_map;
+        uint64_t cache_size = 0;
+        uint64_t cache_max_size = 0;
+        uint64_t cache_generation = 0; ///< incremented by each invalidation
+
+    };
+
+    /// \brief a set of writes and removes that are applied to a storage all at once, with a single sync of the file
+    /// If the commit fails (or the program stops during it), none of the operations are applied.
+    /// \code
+    /// storage::batch batch(my_storage);
+    /// batch.write_to_file("a", a);
+    /// batch.write_to_file("b", b);
+    /// batch.remove("c");
+    /// batch.commit();
+    /// \endcode
+    class storage::batch
+    {
+      public:
+        explicit batch(storage &_owner) : owner(_owner) {}
+
+        /// \brief add the write of an object to the batch (the object is serialized now)
+        template<typename Object>
+        bool write_to_file(const std::string &name, const Object &obj)
+        {
+          raw_data data;
+          if (!storage::_serialize(obj, data))
+            return false;
+
+          batch_operation &op = operations[name];
+          op.remove = false;
+          op.data = std::move(data);
+          return true;
+        }
+
+        /// \brief add the removal of a section to the batch
+        void remove(const std::string &name)
+        {
+          batch_operation &op = operations[name];
+          op.remove = true;
+          op.data = raw_data();
+        }
+
+        /// \brief apply all the operations (the batch is then empty)
+        /// It returns once the operations are on the disk: the file is synced (with a single fsync) before the commit succeeds.
+        /// \return false if the operations can't be applied: the storage is left unchanged and the batch keeps its operations
+        ///         (for thread_safe storages, the batch may be committed with other writes and is emptied anyway)
+        bool commit()
+        {
+          return owner._commit(operations);
+        }
+
+        /// \brief apply all the operations without waiting for the disk (the batch is emptied now)
+        /// \return a future that becomes \b true once the operations are in the file
+        std::future<bool> commit_async()
+        {
+          return owner._commit_async(operations, true, false);
+        }
+
+        /// \brief drop all the operations
+        void clear()
+        {
+          operations.clear();
+        }
+
+        /// \brief return the number of operations in the batch
+        size_t size() const
+        {
+          return operations.size();
+        }
+
+      private:
+        storage &owner;
+        std::map<std::string, batch_operation> operations;
+    };
+
+    /// \brief a section listed by storage::list_sections(): its name, its size and a way to load it
+    /// The handle refers to the section as it was when it was listed (writes made since then aren't seen)
+    /// \code
+    /// for (const storage::section_handle &it : my_storage.list_sections("shard42/"))
+    /// {
+    ///   if (it.get_size() < max_size)
+    ///     my_object *obj = it.load<my_object>();
+    /// }
+    /// \endcode
+    class storage::section_handle
+    {
+      public:
+        /// \brief return the name of the section
+        const std::string &get_name() const
+        {
+          return name;
+        }
+
+        /// \brief return the size of the serialized object
+        uint64_t get_size() const
+        {
+          return sec->get_size();
+        }
+
+        /// \brief deserialize the object (the section is decoded the first time it is loaded)
+        /// \return nullptr if the section is corrupted or if the object can't be deserialized
+        template<typename Object>
+        Object *load() const
+        {
+          return storage::_load_section<Object>(sec);
+        }
+
+      private:
+        section_handle(const std::string &_name, const std::shared_ptr<section> &_sec) : name(_name), sec(_sec) {}
+
+      private:
+        std::string name;
+        std::shared_ptr<section> sec;
 
+        friend class storage;
     };
   } // namespace r
 } // namespace neam
@@ -0,0 +1,111 @@
+//
+// file : stream_hash.hpp
+// in : file:///home/tim/projects/persistence/persistence/stream_hash.hpp
+//
+//
+// Copyright (c) 2014-2016 Timothée Feuillet
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef __N_6958301403468131133_1096753767__STREAM_HASH_HPP__
+# define __N_6958301403468131133_1096753767__STREAM_HASH_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace neam
+{
+  namespace cr
+  {
+    namespace internal
+    {
+      /// \brief A streamable 64bit hash (the data can be fed in chunks of any size)
+      /// \note as the checksum wrapper, this is not intended to be a secure hash
+      class stream_hash
+      {
+        private:
+          static constexpr uint64_t prime_1 = 0x9E3779B185EBCA87ull;
+          static constexpr uint64_t prime_2 = 0xC2B2AE3D27D4EB4Full;
+
+          static inline uint64_t rotl(uint64_t v, unsigned r)
+          {
+            return (v << r) | (v >> (64 - r));
+          }
+
+          inline void round(uint64_t word)
+          {
+            hash = rotl(hash ^ (word * prime_2), 31) * prime_1;
+          }
+
+        public:
+          inline void update(const uint8_t *data, size_t size)
+          {
+            total += size;
+
+            // complete the pending word
+            while (carry_size && size)
+            {
+              carry |= uint64_t(*data++) << (8 * carry_size++);
+              --size;
+              if (carry_size == sizeof(uint64_t))
+              {
+                round(carry);
+                carry = 0;
+                carry_size = 0;
+              }
+            }
+
+            for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), data += sizeof(uint64_t))
+            {
+              uint64_t word;
+              memcpy(&word, data, sizeof(word));
+              round(word);
+            }
+
+            for (; size; --size)
+              carry |= uint64_t(*data++) << (8 * carry_size++);
+          }
+
+          inline uint64_t digest() const
+          {
+            uint64_t h = hash;
+            if (carry_size)
+              h = rotl(h ^ (carry * prime_2), 31) * prime_1;
+            h ^= total * prime_1;
+            h ^= h >> 33;
+            h *= prime_2;
+            h ^= h >> 29;
+            return h;
+          }
+
+        private:
+          uint64_t hash = 0x10F41A0995AA52F1ull;
+          uint64_t total = 0;
+          uint64_t carry = 0;
+          size_t carry_size = 0;
+      };
+    } // namespace internal
+  } // namespace cr
+} // namespace neam
+
+#endif /*__N_6958301403468131133_1096753767__STREAM_HASH_HPP__*/
+
+// kate: indent-mode cstyle; indent-width 2; replace-tabs on;
@@ -1,8 +1,25 @@
 
 #include <map>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 #include <iostream>
+#include <sstream>
+#include <fstream>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
+#include <iterator>
+#include <future>
+#include <thread>
+#include <clocale>
 
 #include <persistence/persistence.hpp>
+#include <persistence/parallel.hpp>
+#include <persistence/background_snapshot.hpp>
+#include <persistence/json_backend/json_stream_reader.hpp>
+#include <persistence/json_backend/json_lines.hpp>
+#include <persistence/json_backend/json_path.hpp>
 #include <persistence/stl.hpp> // I will test the whole STL thing, so yay, I can include this header
 
 #include <persistence/tools/uninitialized.hpp>
@@ -26,6 +43,10 @@ struct _end_test {};
                               catch (_end_test &e) {} \
                               catch (std::exception &e) { neam::cr::out.error() << LOGGER_INFO << #t "" #dt << ": exception " << e.what() << std::endl; }
 
+#define run_simple_test(t, ...) try { t(__VA_ARGS__); neam::cr::out.log() << LOGGER_INFO << #t " " #__VA_ARGS__ << " success !" << std::endl; } \
+                              catch (_end_test &e) {} \
+                              catch (std::exception &e) { neam::cr::out.error() << LOGGER_INFO << #t " " #__VA_ARGS__ << ": exception " << e.what() << std::endl; }
+
 #define fail(msg)             do { neam::cr::out.error() << LOGGER_INFO  << __FUNCTION__ << ": " << msg << std::endl; throw _end_test(); } while(0)
 #define fail_if(cond, msg)    do { if (cond) fail(msg); } while (0)
 
@@ -47,6 +68,8 @@ class stl_basic_test
       // std test
       run_test(basic, std::vector<int>, init_for_int);
       run_test(basic, std::vector<std::string>, init_for_string);
+      run_test(basic, std::vector<double>, init_for_real);
+      run_test(basic, std::vector<float>, init_for_real);
 
       using int_array_5000 = std::array<int, 5000>;
       using string_array_5000 = std::array<std::string, 5000>;
@@ -131,6 +154,8 @@ class stl_basic_test
     template<typename Container>
     static void init_for_string(Container &c) { for (size_t i = 0; i < 10000; ++i) c.push_back(CRAP__VAR_TO_STRING(i - 5000)); }
     template<typename Container>
+    static void init_for_real(Container &c) { for (size_t i = 0; i < 10000; ++i) c.push_back((double(i) - 5000) / 7 * std::pow(10., int(i % 40) - 20)); }
+    template<typename Container>
     static void init_for_int_front(Container &c) { for (size_t i = 0; i < 10000; ++i) c.push_front(i - 5000); }
     template<typename Container>
     static void init_for_string_front(Container &c) { for (size_t i = 0; i < 10000; ++i) c.push_front(CRAP__VAR_TO_STRING(i - 5000)); }
@@ -168,9 +193,1350 @@ class stl_basic_test
     template<typename Container>
     static void p_init_ps_insert(Container &c) { for (size_t i = 0; i < 200; ++i) c.insert(std::make_pair(init_payload(i), CRAP__VAR_TO_STRING(100 - i))); }};
 
+/// \brief This will test the wrappers (data that is transformed after being serialized)
+template<typename Backend>
+class wrapper_test
+{
+  public:
+    static void run()
+    {
+      neam::cr::out.log() << LOGGER_INFO << "running test 'wrapper_test' with backend: " << neam::demangle<Backend>() << std::endl;
+
+      using compressed_string_vector = neam::cr::compressed<std::vector<std::string>>;
+      using compressed_9_string_vector = neam::cr::compressed<std::vector<std::string>, 9>;
+      using stored_string_vector = neam::cr::compressed<std::vector<std::string>, 0>;
+      using compressed_int_map = neam::cr::compressed<std::map<int, int>>;
+      run_test(wrapped, compressed_string_vector, init_for_string);
+      run_test(wrapped, compressed_9_string_vector, init_for_string);
+      run_test(wrapped, stored_string_vector, init_for_string);
+      run_test(wrapped, compressed_int_map, init_for_int_int_insert);
+
+      using full_pipeline = neam::cr::pipeline<std::vector<std::string>, neam::cr::stage::compress<>, neam::cr::stage::checksum, neam::cr::stage::xor_data<>>;
+      using reverse_pipeline = neam::cr::pipeline<std::vector<std::string>, neam::cr::stage::xor_data<>, neam::cr::stage::checksum, neam::cr::stage::compress<3>>;
+      using checksum_pipeline = neam::cr::pipeline<std::map<int, int>, neam::cr::stage::checksum>;
+      run_test(wrapped, full_pipeline, init_for_string);
+      run_test(wrapped, reverse_pipeline, init_for_string);
+      run_test(wrapped, checksum_pipeline, init_for_int_int_insert);
+
+      neam::cr::out.log() << std::endl;
+    }
+
+  private:
+    template<typename Wrapper> struct unwrap {};
+    template<template<typename, unsigned> class Wrapper, typename Container, unsigned Param>
+    struct unwrap<Wrapper<Container, Param>> { using type = Container; };
+    template<typename Container, typename... Stages>
+    struct unwrap<neam::cr::pipeline<Container, Stages...>> { using type = Container; };
+
+    template<typename Wrapper, void (*InitFunc)(typename unwrap<Wrapper>::type &)>
+    static void wrapped()
+    {
+      using container_t = typename unwrap<Wrapper>::type;
+      container_t vct;
+
+      // initialize
+      InitFunc(vct);
+
+      // serialize
+      neam::cr::raw_data rd = neam::cr::persistence::serialize<Backend>(reinterpret_cast<const Wrapper &>(vct));
+      fail_if(!rd.size, "serialization failed");
+
+      // deserialize
+      neam::cr::uninitialized<container_t> comp_vct;
+      void *ret = neam::cr::persistence::deserialize<Backend>(rd, reinterpret_cast<Wrapper *>(&comp_vct));
+      fail_if(!ret, "deserialization failed");
+
+      comp_vct.call_destructor(true);
+
+      fail_if(vct != comp_vct.get(), "deserialization failed: results are differents");
+    }
+
+    template<typename Wrapper>
+    static void init_for_string(typename unwrap<Wrapper>::type &c) { for (size_t i = 0; i < 10000; ++i) c.push_back(CRAP__VAR_TO_STRING(i - 5000)); }
+    template<typename Wrapper>
+    static void init_for_int_int_insert(typename unwrap<Wrapper>::type &c) { for (size_t i = 0; i < 10000; ++i) c.insert(std::make_pair(i - 5000, 5000 - i)); }
+};
+
+/// \brief This will test the loops of the library that run on all the cores
+class parallel_test
+{
+  public:
+    static void run()
+    {
+      neam::cr::out.log() << LOGGER_INFO << "running test 'parallel_test'" << std::endl;
+
+      run_simple_test(all_calls);
+      run_simple_test(exception);
+      run_simple_test(nested);
+
+      neam::cr::out.log() << std::endl;
+    }
+
+  private:
+    static constexpr size_t count = 10000;
+    static constexpr size_t work = 64 * 1024 * 1024; // (always worth using the threads)
+
+    static void all_calls()
+    {
+      for (size_t loop = 0; loop < 20; ++loop)
+      {
+        std::vector<std::atomic<unsigned>> calls(count);
+        neam::cr::internal::parallel_for(count, work, [&](size_t i) { ++calls[i]; });
+        for (size_t i = 0; i < count; ++i)
+          fail_if(calls[i] != 1, "item " << i << " has been processed " << calls[i] << " times");
+      }
+    }
+
+    static void exception()
+    {
+      std::atomic<size_t> calls(0);
+      try
+      {
+        neam::cr::internal::parallel_for(count, work, [&](size_t i)
+        {
+          ++calls;
+          if (i == count / 2)
+            throw std::runtime_error("item failed");
+        });
+      }
+      catch (std::runtime_error &e)
+      {
+        fail_if(std::string(e.what()) != "item failed", "the wrong exception has been rethrown");
+        fail_if(calls > count, "too many calls");
+        return;
+      }
+      fail("the exception of a call has not been rethrown");
+    }
+
+    static void nested()
+    {
+      std::atomic<size_t> sum(0);
+      neam::cr::internal::parallel_for(64, work, [&](size_t i)
+      {
+        neam::cr::internal::parallel_for(count, work, [&](size_t j) { sum += (i == 0 ? j : 1); });
+      });
+      fail_if(sum != count * (count - 1) / 2 + 63 * count, "wrong result: " << sum);
+    }
+};
+
+/// \brief This will test the storage (and the different ways it writes its file)
+class storage_test
+{
+  private:
+    using payload_t = std::vector<std::string>;
+
+  public:
+    static void run()
+    {
+      neam::cr::out.log() << LOGGER_INFO << "running test 'storage_test'" << std::endl;
+
+      run_simple_test(reopen, neam::cr::storage::none);
+      run_simple_test(reopen, neam::cr::storage::use_compression);
+      run_simple_test(reopen, neam::cr::storage::append_only);
+      run_simple_test(reopen, neam::cr::storage::append_only | neam::cr::storage::use_compression);
+      run_simple_test(torn_log);
+      run_simple_test(log_sections_in_file);
+      run_simple_test(rewrite_encoded, neam::cr::storage::none, neam::cr::storage::none);
+      run_simple_test(rewrite_encoded, neam::cr::storage::use_compression, neam::cr::storage::none);
+      run_simple_test(rewrite_encoded, neam::cr::storage::append_only | neam::cr::storage::use_compression, neam::cr::storage::none);
+      run_simple_test(rewrite_encoded, neam::cr::storage::none, neam::cr::storage::append_only);
+      run_simple_test(batch, neam::cr::storage::none);
+      run_simple_test(batch, neam::cr::storage::append_only);
+      run_simple_test(torn_batch);
+      run_simple_test(async, neam::cr::storage::none);
+      run_simple_test(async, neam::cr::storage::append_only | neam::cr::storage::thread_safe);
+      run_simple_test(concurrent_reads, neam::cr::storage::thread_safe);
+      run_simple_test(concurrent_reads, neam::cr::storage::thread_safe | neam::cr::storage::append_only);
+      run_simple_test(lookup, neam::cr::storage::none);
+      run_simple_test(lookup, neam::cr::storage::use_compression);
+      run_simple_test(listing, neam::cr::storage::none);
+      run_simple_test(listing, neam::cr::storage::append_only);
+      run_simple_test(cache);
+      run_simple_test(sharded, neam::cr::storage::none);
+      run_simple_test(sharded, neam::cr::storage::append_only | neam::cr::storage::thread_safe);
+      run_simple_test(raw_sections, neam::cr::storage::none);
+      run_simple_test(raw_sections, neam::cr::storage::append_only);
+      run_simple_test(truncate, neam::cr::storage::none);
+      run_simple_test(truncate, neam::cr::storage::append_only);
+      run_simple_test(legacy_file, false);
+      run_simple_test(legacy_file, true);
+
+      std::remove(filename);
+      for (size_t i = 0; i < shard_count; ++i)
+        std::remove((filename + ("." + CRAP__VAR_TO_STRING(i))).c_str());
+      neam::cr::out.log() << std::endl;
+    }
+
+  private:
+    static constexpr const char *filename = "unit-test.storage";
+    static constexpr size_t shard_count = 4;
+
+    static payload_t make_payload(size_t i)
+    {
+      payload_t ret;
+      for (size_t j = 0; j < i % 50; ++j)
+        ret.push_back(CRAP__VAR_TO_STRING(i * 1000 + j));
+      return ret;
+    }
+
+    static std::string section_name(size_t i)
+    {
+      return "section/" + CRAP__VAR_TO_STRING(i);
+    }
+
+    /// \brief check that the sections [0, count) are in the storage, with the payload of \e version (removed if version is 0)
+    static void check(neam::cr::storage &storage, size_t count, size_t (*version)(size_t))
+    {
+      for (size_t i = 0; i < count; ++i)
+      {
+        const size_t v = version(i);
+        std::unique_ptr<payload_t> ptr(storage.load_from_file<payload_t>(section_name(i)));
+        fail_if(!v && (ptr || storage.contains(section_name(i))), "section " << i << " should have been removed");
+        fail_if(v && !ptr, "unable to load section " << i);
+        fail_if(v && *ptr != make_payload(v), "section " << i << ": results are differents");
+      }
+    }
+
+    static void reopen(uint32_t flags)
+    {
+      std::remove(filename);
+      {
+        neam::cr::storage storage(filename, flags);
+        for (size_t i = 0; i < 200; ++i)
+          fail_if(!storage.write_to_file(section_name(i), make_payload(i + 1)), "write failed");
+        for (size_t i = 0; i < 200; i += 3)
+          fail_if(!storage.write_to_file(section_name(i), make_payload(i + 1000)), "overwrite failed");
+        for (size_t i = 1; i < 200; i += 7)
+          storage.remove(section_name(i));
+        check(storage, 200, version);
+      }
+
+      // the index is rebuilt from the file (the sections are only decoded when they are read)
+      neam::cr::storage storage(filename, flags);
+      fail_if(!storage.is_valid(), "the reopened storage is not valid");
+      check(storage, 200, version);
+      fail_if(!storage.compact(), "compact failed");
+      check(storage, 200, version);
+
+      neam::cr::storage compacted(filename, flags);
+      check(compacted, 200, version);
+    }
+
+    /// \brief rewrite a file (written with \e first_flags) with sections that are still encoded in it
+    static void rewrite_encoded(uint32_t first_flags, uint32_t second_flags)
+    {
+      std::remove(filename);
+      {
+        neam::cr::storage storage(filename, first_flags);
+        for (size_t i = 0; i < 100; ++i)
+          fail_if(!storage.write_to_file(section_name(i), make_payload(i + 1)), "write failed");
+      }
+      {
+        // only one section is read, the other ones are copied from the file
+        neam::cr::storage storage(filename, second_flags);
+        std::unique_ptr<payload_t> ptr(storage.load_from_file<payload_t>(section_name(3)));
+        fail_if(!ptr || *ptr != make_payload(4), "unable to load section 3");
+        fail_if(!storage.write_to_file(section_name(100), make_payload(101)), "write failed");
+        fail_if(!storage.compact(), "compact failed");
+        check(storage, 101, [](size_t i) { return i + 1; });
+      }
+
+      neam::cr::storage storage(filename, second_flags);
+      check(storage, 101, [](size_t i) { return i + 1; });
+    }
+
+    static void batch(uint32_t flags)
+    {
+      std::remove(filename);
+      {
+        neam::cr::storage storage(filename, flags);
+        for (size_t i = 0; i < 10; ++i)
+          fail_if(!storage.write_to_file(section_name(i), make_payload(i + 1)), "write failed");
+
+        neam::cr::storage::batch batch(storage);
+        for (size_t i = 10; i < 20; ++i)
+          fail_if(!batch.write_to_file(section_name(i), make_payload(i + 1)), "batch write failed");
+        batch.remove(section_name(0));
+        fail_if(batch.size() != 11, "wrong batch size");
+        fail_if(storage.contains(section_name(10)) || !storage.contains(section_name(0)), "the batch has been applied before its commit");
+        fail_if(!batch.commit(), "commit failed");
+        fail_if(batch.size(), "the batch has not been emptied");
+        check(storage, 20, [](size_t i) { return i ? i + 1 : 0; });
+      }
+
+      neam::cr::storage storage(filename, flags);
+      check(storage, 20, [](size_t i) { return i ? i + 1 : 0; });
+    }
+
+    /// \brief a batch whose last record isn't completely in the log is not applied at all
+    static void torn_batch()
+    {
+      std::remove(filename);
+      {
+        neam::cr::storage storage(filename, neam::cr::storage::append_only);
+        for (size_t i = 0; i < 10; ++i)
+          fail_if(!storage.write_to_file(section_name(i), make_payload(i + 1)), "write failed");
+
+        neam::cr::storage::batch batch(storage);
+        for (size_t i = 0; i < 20; ++i)
+          fail_if(!batch.write_to_file(section_name(i), make_payload(i + 100)), "batch write failed");
+        fail_if(!batch.commit(), "commit failed");
+      }
+
+      // cut the end of the last record
+      std::string content;
+      {
+        std::ifstream file(filename, std::ios_base::binary);
+        content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+      }
+      {
+        std::ofstream file(filename, std::ios_base::binary | std::ios_base::trunc);
+        file.write(content.data(), content.size() - 10);
+      }
+
+      neam::cr::storage storage(filename, neam::cr::storage::append_only);
+      check(storage, 20, [](size_t i) { return i < 10 ? i + 1 : 0; });
+    }
+
+    static void async(uint32_t flags)
+    {
+      std::remove(filename);
+      {
+        neam::cr::storage storage(filename, flags);
+        std::vector<std::future<bool>> results;
+        for (size_t i = 0; i < 50; ++i)
+          results.push_back(storage.write_to_file_async(section_name(i), make_payload(i + 1)));
+
+        neam::cr::storage::batch batch(storage);
+        for (size_t i = 50; i < 60; ++i)
+          fail_if(!batch.write_to_file(section_name(i), make_payload(i + 1)), "batch write failed");
+        results.push_back(batch.commit_async());
+        fail_if(batch.size(), "the batch has not been emptied");
+
+        // the writes are applied in order, even when they are not async
+        fail_if(!storage.write_to_file(section_name(0), make_payload(1000)), "write failed");
+        storage.remove(section_name(1));
+        results.push_back(storage.sync_async());
+
+        for (auto &it : results)
+          fail_if(!it.get(), "an async write failed");
+        check(storage, 60, [](size_t i) { return i == 0 ? 1000 : (i == 1 ? 0 : i + 1); });
+      }
+
+      neam::cr::storage storage(filename, flags);
+      check(storage, 60, [](size_t i) { return i == 0 ? 1000 : (i == 1 ? 0 : i + 1); });
+    }
+
+    /// \brief readers always see a whole version of a section, while a writer replaces them
+    static void concurrent_reads(uint32_t flags)
+    {
+      std::remove(filename);
+      neam::cr::storage storage(filename, flags);
+      for (size_t i = 0; i < 20; ++i)
+        fail_if(!storage.write_to_file(section_name(i), make_payload(i * 2 + 1)), "write failed");
+
+      std::atomic<bool> done(false);
+      std::atomic<size_t> errors(0);
+      std::vector<std::thread> readers;
+      for (size_t t = 0; t < 4; ++t)
+      {
+        readers.emplace_back([&]()
+        {
+          while (!done)
+          {
+            for (size_t i = 0; i < 20; ++i)
+            {
+              std::unique_ptr<payload_t> ptr(storage.load_from_file<payload_t>(section_name(i)));
+              if (!ptr || (*ptr != make_payload(i * 2 + 1) && *ptr != make_payload(i * 2 + 2)))
+                ++errors;
+            }
+          }
+        });
+      }
+      bool write_failed = false;
+      for (size_t loop = 0; loop < 5; ++loop)
+      {
+        for (size_t i = 0; i < 20; ++i)
+          write_failed |= !storage.write_to_file(section_name(i), make_payload(i * 2 + 1 + (loop + 1) % 2));
+      }
+      done = true;
+      for (auto &it : readers)
+        it.join();
+      fail_if(write_failed, "write failed");
+      fail_if(errors, errors << " reads have returned a wrong section");
+    }
+
+    /// \brief contains() and load_from_file() probe the hash table of the file (nothing is loaded when the storage is opened)
+    static void lookup(uint32_t flags)
+    {
+      std::remove(filename);
+      {
+        neam::cr::storage storage(filename, flags);
+        neam::cr::storage::batch batch(storage);
+        for (size_t i = 0; i < 1000; ++i)
+          fail_if(!batch.write_to_file(section_name(i), make_payload(i + 1)), "batch write failed");
+        fail_if(!batch.commit(), "commit failed");
+      }
+
+      neam::cr::storage storage(filename, flags);
+      for (size_t i = 0; i < 1000; ++i)
+        fail_if(!storage.contains(section_name(i)), "section " << i << " is missing");
+      for (size_t i = 1000; i < 2000; ++i)
+        fail_if(storage.contains(section_name(i)), "section " << i << " should not be there");
+      fail_if(storage.contains(""), "the empty name should not be there");
+      fail_if(storage.load_from_file<payload_t>("section/"), "a missing section has been loaded");
+
+      // the changes made since the file was opened are seen too
+      storage.remove(section_name(3));
+      fail_if(!storage.write_to_file(section_name(1000), make_payload(1001)), "write failed");
+      fail_if(storage.contains(section_name(3)) || !storage.contains(section_name(1000)), "the changes are not seen");
+      check(storage, 1001, [](size_t i) { return i == 3 ? 0 : i + 1; });
+    }
+
+    /// \brief list_sections() merges the sections of the file with the changes made since it has been opened
+    static void listing(uint32_t flags)
+    {
+      std::remove(filename);
+      {
+        neam::cr::storage storage(filename, flags);
+        for (size_t i = 0; i < 100; ++i)
+          fail_if(!storage.write_to_file((i % 2 ? "odd/" : "even/") + CRAP__VAR_TO_STRING(i + 100), make_payload(i + 1)), "write failed");
+      }
+
+      neam::cr::storage storage(filename, flags);
+      fail_if(!storage.write_to_file("odd/", make_payload(1)), "write failed");
+      fail_if(!storage.write_to_file("odd/250", make_payload(2)), "write failed");
+      storage.remove("odd/101");
+      storage.remove("even/100");
+
+      std::vector<neam::cr::storage::section_handle> odd = storage.list_sections("odd/");
+      fail_if(odd.size() != 51, "wrong number of sections: " << odd.size());
+      for (size_t i = 1; i < odd.size(); ++i)
+        fail_if(!(odd[i - 1].get_name() < odd[i].get_name()), "the sections are not sorted");
+      fail_if(odd.front().get_name() != "odd/" || odd.back().get_name() != "odd/250", "wrong first or last section");
+
+      std::vector<neam::cr::storage::section_handle> range = storage.list_sections("even/110", "even/120");
+      fail_if(range.size() != 5 || range.front().get_name() != "even/110" || range.back().get_name() != "even/118", "wrong range");
+      fail_if(storage.list_sections("nothing/").size(), "the listing of a missing prefix is not empty");
+      fail_if(storage.list_sections().size() != 100, "wrong number of sections");
+
+      // a handle keeps the section as it was listed
+      fail_if(!storage.write_to_file("even/110", make_payload(1000)), "write failed");
+      std::unique_ptr<payload_t> ptr(range.front().load<payload_t>());
+      fail_if(!ptr || *ptr != make_payload(11), "the handle doesn't load the listed section");
+      fail_if(range.front().get_size() == 0, "wrong section size");
+    }
+
+    static void cache()
+    {
+      std::remove(filename);
+      neam::cr::storage storage(filename);
+      for (size_t i = 0; i < 10; ++i)
+        fail_if(!storage.write_to_file(section_name(i), make_payload(i + 10)), "write failed");
+
+      // disabled by default
+      std::shared_ptr<const payload_t> first = storage.load_shared<payload_t>(section_name(0));
+      fail_if(!first || *first != make_payload(10), "unable to load section 0");
+      fail_if(storage.load_shared<payload_t>(section_name(0)) == first, "the cache should be disabled");
+
+      storage.set_cache_size(1024 * 1024);
+      first = storage.load_shared<payload_t>(section_name(0));
+      fail_if(storage.load_shared<payload_t>(section_name(0)) != first, "the object has not been cached");
+      fail_if(storage.load_shared<payload_t>(section_name(42)), "a missing section has been loaded");
+
+      // a write (or a remove) invalidates the cached object
+      fail_if(!storage.write_to_file(section_name(0), make_payload(100)), "write failed");
+      std::shared_ptr<const payload_t> second = storage.load_shared<payload_t>(section_name(0));
+      fail_if(second == first || !second || *second != make_payload(100), "a stale object has been returned");
+      fail_if(*first != make_payload(10), "a cached object has been modified");
+      storage.remove(section_name(0));
+      fail_if(storage.load_shared<payload_t>(section_name(0)), "a removed section has been loaded");
+
+      // the least recently used objects are evicted
+      storage.set_cache_size(1);
+      std::shared_ptr<const payload_t> third = storage.load_shared<payload_t>(section_name(1));
+      fail_if(!third || storage.load_shared<payload_t>(section_name(1)) == third, "an object bigger than the cache has been cached");
+    }
+
+    static void sharded(uint32_t flags)
+    {
+      for (size_t i = 0; i < shard_count; ++i)
+        std::remove((filename + ("." + CRAP__VAR_TO_STRING(i))).c_str());
+      {
+        neam::cr::sharded_storage storage(filename, shard_count, flags);
+        fail_if(storage.get_shard_count() != shard_count, "wrong shard count");
+        for (size_t i = 0; i < 50; ++i)
+          fail_if(!storage.write_to_file(section_name(i), make_payload(i + 1)), "write failed");
+
+        // a batch that spans all the shards
+        neam::cr::sharded_storage::batch batch(storage);
+        for (size_t i = 50; i < 100; ++i)
+          fail_if(!batch.write_to_file(section_name(i), make_payload(i + 1)), "batch write failed");
+        batch.remove(section_name(7));
+        fail_if(batch.size() != 51, "wrong batch size");
+        fail_if(!batch.commit(), "commit failed");
+        fail_if(batch.size(), "the batch has not been emptied");
+        storage.remove(section_name(8));
+      }
+
+      neam::cr::sharded_storage storage(filename, shard_count, flags);
+      fail_if(!storage.is_valid(), "the reopened storage is not valid");
+      std::vector<size_t> sections_per_shard(shard_count);
+      for (size_t i = 0; i < 100; ++i)
+      {
+        const bool removed = (i == 7 || i == 8);
+        std::unique_ptr<payload_t> ptr(storage.load_from_file<payload_t>(section_name(i)));
+        fail_if(removed != !ptr, "section " << i << " has not been loaded (or removed)");
+        fail_if(ptr && *ptr != make_payload(i + 1), "section " << i << ": results are differents");
+        fail_if(storage.contains(section_name(i)) != storage.get_shard(section_name(i)).contains(section_name(i)), "section " << i << " is not in its shard");
+        ++sections_per_shard[storage.get_shard_index(section_name(i))];
+      }
+      for (size_t i = 0; i < shard_count; ++i)
+        fail_if(!sections_per_shard[i], "shard " << i << " is empty");
+
+      // the listings merge the shards
+      std::vector<neam::cr::storage::section_handle> all = storage.list_sections("section/");
+      fail_if(all.size() != 98, "wrong number of sections: " << all.size());
+      for (size_t i = 1; i < all.size(); ++i)
+        fail_if(!(all[i - 1].get_name() < all[i].get_name()), "the sections are not sorted");
+      std::vector<neam::cr::storage::section_handle> range = storage.list_sections("section/20", "section/30"); // (section/3 is in the range)
+      fail_if(range.size() != 11 || range.front().get_name() != "section/20" || range.back().get_name() != "section/3", "wrong range: " << range.size());
+      fail_if(!storage.compact(), "compact failed");
+
+      // a shard count of 0 is rejected
+      neam::cr::sharded_storage no_shards(filename, 0, flags);
+      fail_if(no_shards.is_valid() || no_shards.get_shard_count(), "a storage without shards is valid");
+      fail_if(no_shards.write_to_file(section_name(0), make_payload(1)), "a write without shards succeeded");
+      fail_if(no_shards.write_to_file_async(section_name(0), make_payload(1)).get(), "an async write without shards succeeded");
+      fail_if(no_shards.load_from_file<payload_t>(section_name(0)) || no_shards.contains(section_name(0)), "a load without shards succeeded");
+      neam::cr::sharded_storage::batch no_shards_batch(no_shards);
+      fail_if(no_shards_batch.write_to_file(section_name(0), make_payload(1)), "a batch write without shards succeeded");
+      fail_if(no_shards.compact(), "a compaction without shards succeeded");
+    }
+
+    /// \brief the serialized objects are handed to the storage, but raw buffers stay owned by the caller
+    static void raw_sections(uint32_t flags)
+    {
+      std::remove(filename);
+      neam::cr::storage storage(filename, flags);
+
+      std::vector<std::string> big(200000);
+      for (size_t i = 0; i < big.size(); ++i)
+        big[i] = CRAP__VAR_TO_STRING(i);
+      fail_if(!storage.write_to_file("big", big), "write failed");
+
+      std::string buffer = "some raw data";
+      fail_if(!storage._write_to_file("raw", &buffer[0], buffer.size()), "raw write failed");
+      buffer[0] = 'S'; // (the storage has its own copy)
+
+      std::shared_ptr<const neam::cr::raw_data> raw = storage._read_from_file("raw");
+      fail_if(!raw || std::string(reinterpret_cast<const char *>(raw->data), raw->size) != "some raw data", "wrong raw section");
+      fail_if(!storage.write_to_file("raw", big), "overwrite failed");
+      fail_if(std::string(reinterpret_cast<const char *>(raw->data), raw->size) != "some raw data", "the data of a raw section has not been kept");
+      fail_if(storage._read_from_file("missing"), "a missing raw section has been read");
+      fail_if(!storage._write_to_file("raw", &buffer[0], buffer.size()), "raw write failed");
+
+      std::unique_ptr<std::vector<std::string>> ptr(storage.load_from_file<std::vector<std::string>>("big"));
+      fail_if(!ptr || *ptr != big, "unable to load the big section");
+
+      neam::cr::storage reopened(filename, flags);
+      ptr.reset(reopened.load_from_file<std::vector<std::string>>("big"));
+      fail_if(!ptr || *ptr != big, "unable to load the big section from the file");
+      raw = reopened._read_from_file("raw");
+      fail_if(!raw || std::string(reinterpret_cast<const char *>(raw->data), raw->size) != "Some raw data", "wrong raw section in the file");
+      reopened.remove("raw");
+      fail_if(std::string(reinterpret_cast<const char *>(raw->data), raw->size) != "Some raw data", "the data of a removed section has not been kept");
+    }
+
+    static void truncate(uint32_t flags)
+    {
+      std::remove(filename);
+      neam::cr::storage storage(filename, flags);
+      for (size_t i = 0; i < 10; ++i)
+        fail_if(!storage.write_to_file(section_name(i), make_payload(i + 1)), "write failed");
+      storage.truncate();
+      fail_if(!storage.is_valid(), "a truncated storage should be valid");
+      check(storage, 10, [](size_t) -> size_t { return 0; });
+      fail_if(!storage.write_to_file(section_name(0), make_payload(1)), "write after a truncate failed");
+
+      neam::cr::storage reopened(filename, flags);
+      check(reopened, 10, [](size_t i) -> size_t { return i ? 0 : 1; });
+    }
+
+    /// \brief the files written by the previous versions of the storage (a map of the sections) can still be read
+    static void legacy_file(bool compressed)
+    {
+      using map_t = std::map<std::string, neam::cr::raw_data>;
+      map_t sections;
+      for (size_t i = 0; i < 10; ++i)
+      {
+        const payload_t payload = make_payload(i + 1);
+        neam::cr::raw_data data = neam::cr::persistence::serialize<neam::cr::persistence_backend::neam>(reinterpret_cast<const neam::cr::checksum<payload_t> &>(payload));
+        fail_if(!data.size, "serialization failed");
+        --data.size; // (the '\0' that serialize() adds isn't part of the section)
+        sections.emplace(section_name(i), std::move(data));
+      }
+      neam::cr::raw_data file_data = compressed
+        ? neam::cr::persistence::serialize<neam::cr::persistence_backend::neam>(reinterpret_cast<const neam::cr::xor_data<neam::cr::compressed<map_t>> &>(sections))
+        : neam::cr::persistence::serialize<neam::cr::persistence_backend::neam>(reinterpret_cast<const neam::cr::xor_data<map_t> &>(sections));
+      fail_if(!file_data.size, "serialization failed");
+      {
+        std::ofstream file(filename, std::ios_base::binary | std::ios_base::trunc);
+        file.write(reinterpret_cast<const char *>(file_data.data), file_data.size - 1);
+      }
+
+      {
+        neam::cr::storage storage(filename);
+        fail_if(!storage.is_valid(), "the legacy file is not valid");
+        check(storage, 10, [](size_t i) { return i + 1; });
+
+        // the next write converts the file
+        fail_if(!storage.write_to_file(section_name(10), make_payload(11)), "write failed");
+      }
+      neam::cr::storage storage(filename);
+      check(storage, 11, [](size_t i) { return i + 1; });
+    }
+
+    static size_t version(size_t i)
+    {
+      if (i % 7 == 1) return 0;
+      return i % 3 ? i + 1 : i + 1000;
+    }
+
+    /// \brief the sections appended to a log are read back from the file: their data doesn't stay in memory
+    static void log_sections_in_file()
+    {
+      // (without mmap, the appended sections stay in memory)
+      if (!neam::cr::internal::file_mapping::sees_appends)
+        return;
+
+      std::remove(filename);
+      neam::cr::storage storage(filename, neam::cr::storage::append_only);
+      for (size_t i = 0; i < 20; ++i)
+        fail_if(!storage.write_to_file(section_name(i), make_payload(i + 1)), "write failed");
+      neam::cr::storage::batch batch(storage);
+      for (size_t i = 20; i < 40; ++i)
+        fail_if(!batch.write_to_file(section_name(i), make_payload(i + 1)), "batch write failed");
+      fail_if(!batch.commit(), "commit failed");
+
+      // damage the file in place: none of the sections can be read anymore
+      std::string content;
+      {
+        std::ifstream file(filename, std::ios_base::binary);
+        content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+      }
+      for (size_t i = 16; i < content.size(); ++i)
+        content[i] = static_cast<char>(~content[i]);
+      {
+        std::fstream file(filename, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+        file.write(content.data(), content.size());
+      }
+      for (size_t i = 0; i < 40; ++i)
+        fail_if(std::unique_ptr<payload_t>(storage.load_from_file<payload_t>(section_name(i))), "section " << i << " has been kept in memory");
+    }
+
+    /// \brief the garbage at the end of a log (an interrupted write) is ignored
+    static void torn_log()
+    {
+      std::remove(filename);
+      {
+        neam::cr::storage storage(filename, neam::cr::storage::append_only);
+        for (size_t i = 0; i < 10; ++i)
+          fail_if(!storage.write_to_file(section_name(i), make_payload(i + 1)), "write failed");
+      }
+      {
+        std::ofstream file(filename, std::ios_base::binary | std::ios_base::app);
+        file << "a torn record";
+      }
+
+      neam::cr::storage storage(filename, neam::cr::storage::append_only);
+      check(storage, 10, [](size_t i) { return i + 1; });
+      fail_if(!storage.write_to_file(section_name(10), make_payload(11)), "write after a torn record failed");
+
+      neam::cr::storage reopened(filename, neam::cr::storage::append_only);
+      check(reopened, 11, [](size_t i) { return i + 1; });
+    }
+};
+
+/// \brief This will test the snapshots written by a forked process
+class snapshot_test
+{
+  public:
+    static void run()
+    {
+      neam::cr::out.log() << LOGGER_INFO << "running test 'snapshot_test'" << std::endl;
+
+      run_simple_test(snapshot, false);
+      run_simple_test(snapshot, true);
+      run_simple_test(busy_threads);
+
+      neam::cr::out.log() << std::endl;
+    }
+
+  private:
+    using object_t = std::map<std::string, std::vector<int>>;
+    static constexpr const char *filename = "unit-test.snapshot";
+
+    static object_t make_object()
+    {
+      object_t obj;
+      for (int i = 0; i < 1000; ++i)
+        obj["key/" + std::to_string(i)] = std::vector<int>(i % 50, i);
+      return obj;
+    }
+
+    static std::string read_file()
+    {
+      std::ifstream file(filename, std::ios_base::binary);
+      return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+
+    /// \brief the snapshot is the object as it was when the snapshot was taken
+    static void snapshot(bool modify)
+    {
+      std::remove(filename);
+      object_t obj = make_object();
+      neam::cr::snapshot_process process = neam::cr::persistence::background_snapshot<neam::cr::persistence_backend::neam>(obj, filename);
+      if (modify)
+      {
+        obj.clear();
+        obj["modified"] = {1, 2, 3};
+      }
+      fail_if(!process.wait(), "the snapshot has failed");
+      fail_if(!process.is_done(), "the process should be done");
+
+      std::string content = read_file();
+      neam::cr::raw_data data(content.size(), reinterpret_cast<int8_t *>(&content[0]), neam::force_duplicate);
+      std::unique_ptr<object_t> back(neam::cr::persistence::deserialize<neam::cr::persistence_backend::neam, object_t>(data));
+      fail_if(!back, "unable to deserialize the snapshot");
+      fail_if(*back != make_object(), "results are differents");
+    }
+
+    /// \brief no process is forked while a thread of the library works
+    static void busy_threads()
+    {
+      std::remove(filename);
+      const object_t obj = make_object();
+      {
+        neam::cr::internal::thread_activity::scope activity;
+        neam::cr::snapshot_process process = neam::cr::persistence::background_snapshot<neam::cr::persistence_backend::neam>(obj, filename);
+        fail_if(!process.is_done() || process.wait(), "the snapshot should have been refused");
+      }
+      std::ifstream file(filename);
+      fail_if(file.good(), "no snapshot should have been written");
+
+      neam::cr::snapshot_process process = neam::cr::persistence::background_snapshot<neam::cr::persistence_backend::neam>(obj, filename);
+      fail_if(!process.wait(), "the snapshot has failed");
+    }
+};
+
+/// \brief This will test the internals of the JSON backend
+class json_test
+{
+  public:
+    static void run()
+    {
+      neam::cr::out.log() << LOGGER_INFO << "running test 'json_test'" << std::endl;
+
+      run_simple_test(structural_index);
+      run_simple_test(structural_index_malformed);
+      run_simple_test(indexed_document);
+      run_simple_test(malformed_lists, false);
+      run_simple_test(malformed_lists, true);
+      run_simple_test(malformed_collections, false);
+      run_simple_test(malformed_collections, true);
+      run_simple_test(escaping);
+      run_simple_test(unescaping);
+      run_simple_test(integer_limits);
+      run_simple_test(long_floats);
+      run_simple_test(exponents);
+      run_simple_test(comma_locale);
+      run_simple_test(parallel_write);
+      run_simple_test(json_lines);
+      run_simple_test(json_path);
+      run_simple_test(json_lines_malformed);
+      for (size_t chunk_size : {1, 2, 3, 7, 64})
+      {
+        run_simple_test(stream_reader, chunk_size);
+        run_simple_test(stream_reader_malformed, chunk_size);
+      }
+
+      neam::cr::out.log() << std::endl;
+    }
+
+  private:
+    /// \brief the ends and the element counts of the strings / lists / collections of a document
+    static void structural_index()
+    {
+      // (the padding moves the escapes and the quotes across the 64 bytes blocks)
+      for (size_t padding = 0; padding < 70; ++padding)
+      {
+        const std::string doc = std::string(padding, ' ') + "{\"a\": [1, 2, {\"b\": \"x\\\"]\"}], \"c\": \"\\\\\", \"d\": [ ], \"e\": [[], [1], \"[,]\"]"
+                                + ", \"pad\": \"" + std::string(300, '.') + "\"}";
+        neam::cr::internal::json::structural_index index(doc.data(), doc.size());
+        fail_if(!index.is_valid(), "padding " << padding << ": the document should be valid");
+
+        const char *base = doc.data();
+        size_t count = 0;
+        fail_if(index.get_end(base + padding) != base + doc.size() - 1, "padding " << padding << ": wrong end for the document");
+        fail_if(!index.get_element_count(base + padding, count) || count != 5, "padding " << padding << ": wrong member count");
+
+        const size_t a = doc.find('[');
+        fail_if(index.get_end(base + a) != base + doc.find("], \"c\""), "padding " << padding << ": wrong end for a");
+        fail_if(!index.get_element_count(base + a, count) || count != 3, "padding " << padding << ": wrong element count for a");
+
+        const size_t x = doc.find("\"x");
+        fail_if(index.get_end(base + x) != base + doc.find("\"}]"), "padding " << padding << ": wrong end for an escaped string");
+        const size_t c = doc.find("\"\\\\\"");
+        fail_if(index.get_end(base + c) != base + c + 3, "padding " << padding << ": wrong end for a string that ends with a backslash");
+
+        const size_t d = doc.find("[ ]");
+        fail_if(!index.get_element_count(base + d, count) || count != 0, "padding " << padding << ": an empty list has no element");
+        const size_t e = doc.find("[[]");
+        fail_if(!index.get_element_count(base + e, count) || count != 3, "padding " << padding << ": wrong element count for e");
+        fail_if(!index.get_element_count(base + e + 5, count) || count != 1, "padding " << padding << ": wrong element count for e[1]");
+
+        fail_if(index.get_end(base + a + 1), "padding " << padding << ": a number has no end");
+        fail_if(index.get_element_count(base + x, count), "padding " << padding << ": a string has no element");
+      }
+    }
+
+    /// \brief documents with unbalanced brackets can't be indexed
+    static void structural_index_malformed()
+    {
+      const std::string padding = ", \"" + std::string(300, '.') + "\"";
+      const char *docs[] = {"[1, 2}", "{\"a\": [1}", "]", "[1, 2]]"};
+      for (const char *it : docs)
+      {
+        const std::string doc = std::string(it) + padding;
+        neam::cr::internal::json::structural_index index(doc.data(), doc.size());
+        fail_if(index.is_valid(), "'" << it << "' should not be valid");
+      }
+
+      // unclosed elements are valid, but have no end
+      const std::string doc = "[[1, 2], [3" + padding;
+      neam::cr::internal::json::structural_index index(doc.data(), doc.size());
+      fail_if(!index.is_valid(), "an unclosed list should be valid");
+      fail_if(index.get_end(doc.data()), "an unclosed list has no end");
+      fail_if(index.get_end(doc.data() + 1) != doc.data() + 6, "wrong end for the closed list");
+    }
+
+    /// \brief lists with a missing element are rejected, whether the document is indexed (\e big) or scanned
+    static void malformed_lists(bool big)
+    {
+      // (the big documents are padded with whitespaces, so they are indexed)
+      const std::string padding = (big ? std::string(neam::cr::internal::json::structural_index::min_document_size, ' ') : std::string());
+      const char *malformed[] = {"[1,2,]", "[1, 2 , ]", "[1,,2]", "[,1]", "[1 2]", "[1, 2 3]", "[[1],[2],]", "[[1] [2]]", "[\"a\",]", "[\"a\" \"b\"]", "[\"a\" \"\"]", "[[1]], [2]]", "[[1]]]"};
+      for (const char *it : malformed)
+      {
+        std::string doc = std::string(it) + padding;
+        neam::cr::raw_data data(doc.size(), reinterpret_cast<int8_t *>(&doc[0]), neam::force_duplicate);
+        if (it[1] == '[')
+          fail_if(std::unique_ptr<std::vector<std::vector<int>>>(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::vector<std::vector<int>>>(data)), "'" << it << "' should not be deserialized");
+        else if (it[1] == '"')
+          fail_if(std::unique_ptr<std::vector<std::string>>(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::vector<std::string>>(data)), "'" << it << "' should not be deserialized");
+        else
+          fail_if(std::unique_ptr<std::vector<int>>(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::vector<int>>(data)), "'" << it << "' should not be deserialized");
+      }
+
+      const char *well_formed[] = {"[1,2]", "[ 1 , 2 ]", "[]", "[ ]"};
+      const size_t counts[] = {2, 2, 0, 0};
+      for (size_t i = 0; i < sizeof(well_formed) / sizeof(well_formed[0]); ++i)
+      {
+        std::string doc = std::string(well_formed[i]) + padding;
+        neam::cr::raw_data data(doc.size(), reinterpret_cast<int8_t *>(&doc[0]), neam::force_duplicate);
+        std::unique_ptr<std::vector<int>> back(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::vector<int>>(data));
+        fail_if(!back || back->size() != counts[i], "'" << well_formed[i] << "' should be deserialized");
+      }
+
+      // a big list, with a trailing comma
+      std::vector<int> list(500, 42);
+      neam::cr::raw_data data = neam::cr::persistence::serialize<neam::cr::persistence_backend::json_compact>(list);
+      std::string doc(reinterpret_cast<const char *>(data.data), data.size - 1);
+      doc.insert(doc.size() - 1, ",");
+      neam::cr::raw_data malformed_data(doc.size(), reinterpret_cast<int8_t *>(&doc[0]), neam::force_duplicate);
+      fail_if(std::unique_ptr<std::vector<int>>(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::vector<int>>(malformed_data)), "a big list with a trailing comma should not be deserialized");
+    }
+
+    /// \brief collections with a missing member or a missing comma are rejected, whether the document is indexed (\e big) or scanned
+    static void malformed_collections(bool big)
+    {
+      const std::string padding = (big ? std::string(neam::cr::internal::json::structural_index::min_document_size, ' ') : std::string());
+      const char *malformed[] = {"{\"a\":1 \"b\":2}", "{\"a\":1,}", "{\"a\":1,,\"b\":2}", "{\"a\"}:1}", "{\"a\" 1}", "{\"a\":1}}", "{\"a\":1}, \"b\":2}"};
+      for (const char *it : malformed)
+        fail_if((read_document<std::map<std::string, int>>(std::string(it) + padding)), "'" << it << "' should not be deserialized");
+
+      const char *well_formed[] = {"{\"a\":1,\"b\":2}", "{ \"a\" : 1 , \"b\" : 2 }", "{}", "{ }"};
+      const size_t counts[] = {2, 2, 0, 0};
+      for (size_t i = 0; i < sizeof(well_formed) / sizeof(well_formed[0]); ++i)
+      {
+        std::unique_ptr<std::map<std::string, int>> back = read_document<std::map<std::string, int>>(std::string(well_formed[i]) + padding);
+        fail_if(!back || back->size() != counts[i], "'" << well_formed[i] << "' should be deserialized");
+      }
+
+      // the members of a nested collection
+      std::unique_ptr<std::map<std::string, std::map<std::string, int>>> nested = read_document<std::map<std::string, std::map<std::string, int>>>("{\"x\":{\"a\":1 \"b\":2}}" + padding);
+      fail_if(nested, "two nested members without a comma should not be deserialized");
+      nested = read_document<std::map<std::string, std::map<std::string, int>>>("{\"x\":{\"a\":1,\"b\":2},\"y\":{}}" + padding);
+      fail_if(!nested || nested->size() != 2 || (*nested)["x"]["b"] != 2, "nested collections should be deserialized");
+    }
+
+    /// \brief every character is escaped and read back, wherever it is in the string (the runs are copied 16 bytes at a time)
+    static void escaping()
+    {
+      for (size_t size = 0; size < 40; ++size)
+      {
+        for (size_t first = 0; first < 256; first += 7)
+        {
+          std::string str;
+          for (size_t i = 0; i < size; ++i)
+            str.push_back(static_cast<char>(size % 5 ? (first + i) % 256 : 'a' + i % 26));
+
+          neam::cr::raw_data data = neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(str);
+          fail_if(!data.data, "unable to serialize the string");
+          for (size_t i = 0; i < data.size - 1; ++i)
+          {
+            const unsigned char c = static_cast<unsigned char>(reinterpret_cast<const char *>(data.data)[i]);
+            fail_if(c < ' ' || c >= 0x80, "the character " << unsigned(c) << " should have been escaped");
+          }
+          std::unique_ptr<std::string> back(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::string>(data));
+          fail_if(!back || *back != str, "size " << size << ", first " << first << ": results are differents");
+
+          // as the name of a member
+          std::map<std::string, std::string> obj;
+          obj[str] = str;
+          data = neam::cr::persistence::serialize<neam::cr::persistence_backend::json_compact>(obj);
+          std::unique_ptr<std::map<std::string, std::string>> back_obj(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::map<std::string, std::string>>(data));
+          fail_if(!back_obj || *back_obj != obj, "size " << size << ", first " << first << ": results are differents for a key");
+
+          // as raw data
+          neam::cr::raw_data raw(str.size(), reinterpret_cast<int8_t *>(&str[0]), neam::force_duplicate);
+          data = neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(raw);
+          std::unique_ptr<neam::cr::raw_data> back_raw(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, neam::cr::raw_data>(data));
+          fail_if(!back_raw || back_raw->size != raw.size || (raw.size && memcmp(back_raw->data, raw.data, raw.size)), "size " << size << ", first " << first << ": results are differents for raw data");
+        }
+      }
+    }
+
+    template<typename Type>
+    static std::unique_ptr<Type> read_document(std::string doc)
+    {
+      neam::cr::raw_data data(doc.size(), reinterpret_cast<int8_t *>(&doc[0]), neam::force_duplicate);
+      return std::unique_ptr<Type>(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, Type>(data));
+    }
+
+    /// \brief the escape sequences written by hand (or by other serializers)
+    static void unescaping()
+    {
+      std::unique_ptr<std::string> str = read_document<std::string>("\"a\\nb\\u0041\\/\\\\\\\"\\t\\u00e9\"");
+      fail_if(!str || *str != "a\nbA/\\\"\t\xe9", "escape sequences");
+      str = read_document<std::string>("\"no escape at all\"");
+      fail_if(!str || *str != "no escape at all", "a string without escape");
+      str = read_document<std::string>("\"\"");
+      fail_if(!str || !str->empty(), "an empty string");
+
+      const char *malformed[] = {"\"\\x\"", "\"\\u12\"", "\"\\u12zz\"", "\"abc\\"};
+      for (const char *it : malformed)
+        fail_if(read_document<std::string>(it), it << " should not be deserialized");
+
+      // the keys are matched in the document
+      std::unique_ptr<std::map<std::string, int>> obj = read_document<std::map<std::string, int>>("{\"a\\\"b\": 1, \"\\u0063\": 2, \"plain\": 3}");
+      fail_if(!obj || obj->size() != 3 || (*obj)["a\"b"] != 1 || (*obj)["c"] != 2 || (*obj)["plain"] != 3, "escaped keys");
+
+      std::unique_ptr<std::vector<std::string>> list = read_document<std::vector<std::string>>("[\"\\\"[\", \"]\\\\\", \"\\u005d\"]");
+      fail_if(!list || *list != std::vector<std::string>({"\"[", "]\\", "]"}), "escaped brackets in a list");
+    }
+
+    /// \brief the big lists and collections written by all the cores (when enabled) are the same as the ones written by a single thread
+    static void parallel_write()
+    {
+      std::vector<std::string> list(100000);
+      std::map<int, std::vector<int>> collection;
+      for (size_t i = 0; i < list.size(); ++i)
+      {
+        list[i] = "element \"" + std::to_string(i) + "\"";
+        if (i % 2)
+          collection[static_cast<int>(i)] = std::vector<int>(i % 3, static_cast<int>(i));
+      }
+      std::vector<std::vector<std::string>> nested(3, std::vector<std::string>(list.begin(), list.begin() + 40000));
+
+      neam::cr::raw_data sequential[] =
+      {
+        neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(list),
+        neam::cr::persistence::serialize<neam::cr::persistence_backend::json_compact>(collection),
+        neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(nested),
+      };
+
+      neam::cr::set_json_parallel_threshold();
+      neam::cr::raw_data parallel[] =
+      {
+        neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(list),
+        neam::cr::persistence::serialize<neam::cr::persistence_backend::json_compact>(collection),
+        neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(nested),
+      };
+      neam::cr::set_json_parallel_threshold(0);
+
+      for (size_t i = 0; i < 3; ++i)
+      {
+        fail_if(!sequential[i].data || !parallel[i].data, "unable to serialize the document #" << i);
+        fail_if(sequential[i].size != parallel[i].size || memcmp(sequential[i].data, parallel[i].data, sequential[i].size), "the document #" << i << " is different when written in parallel");
+      }
+      std::unique_ptr<std::vector<std::string>> back(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::vector<std::string>>(parallel[0]));
+      fail_if(!back || *back != list, "results are differents");
+    }
+
+    /// \brief only the value at a path is deserialized
+    static void json_path()
+    {
+      std::string doc = "{\"a\": {\"b\": [10, 20, {\"c\": \"x]\\\"}\"}], \"d\\\"e\": 5}, \"n\": {\"42\": [1,2,3]}, \"s\": \"str\", \"t\": true}";
+      neam::cr::raw_data data(doc.size(), reinterpret_cast<int8_t *>(&doc[0]), neam::force_duplicate);
+
+      std::unique_ptr<int> i(neam::cr::json_at<int>(data, "a", "b", 1));
+      fail_if(!i || *i != 20, "a.b[1]");
+      i.reset(neam::cr::json_at<int>(data, "a", "b", "0"));
+      fail_if(!i || *i != 10, "a.b[\"0\"]");
+      i.reset(neam::cr::json_at<int>(data, "a", "d\"e"));
+      fail_if(!i || *i != 5, "an escaped member name");
+      i.reset(neam::cr::json_at<int>(data, "n", 42, 2));
+      fail_if(!i || *i != 3, "n[42][2]: a number as a member name");
+      std::unique_ptr<std::string> str(neam::cr::json_at<std::string>(data, "a", "b", 2, "c"));
+      fail_if(!str || *str != "x]\"}", "a string with brackets");
+      std::unique_ptr<std::vector<int>> list(neam::cr::json_at<std::vector<int>>(data, "n", std::string("42")));
+      fail_if(!list || *list != std::vector<int>({1, 2, 3}), "a list");
+      std::unique_ptr<bool> b(neam::cr::json_at<bool>(data, "t"));
+      fail_if(!b || !*b, "a boolean after a skipped string");
+
+      const char *value = nullptr;
+      size_t value_size = 0;
+      fail_if(!neam::cr::json_find(data, value, value_size, "a", "b") || std::string(value, value_size) != "[10, 20, {\"c\": \"x]\\\"}\"}]", "the value of a.b");
+      fail_if(!neam::cr::json_find(data, value, value_size) || value_size != doc.size(), "an empty path is the whole document");
+
+      // the paths that aren't in the document, and the values that have another type
+      fail_if(std::unique_ptr<int>(neam::cr::json_at<int>(data, "a", "z")), "a.z isn't in the document");
+      fail_if(std::unique_ptr<int>(neam::cr::json_at<int>(data, "a", "b", 3)), "a.b[3] isn't in the document");
+      fail_if(std::unique_ptr<int>(neam::cr::json_at<int>(data, "a", "b", -1)), "a.b[-1] isn't in the document");
+      fail_if(std::unique_ptr<int>(neam::cr::json_at<int>(data, "a", "b", "x")), "x isn't an index");
+      fail_if(std::unique_ptr<int>(neam::cr::json_at<int>(data, "s", 0)), "a string has no element");
+      fail_if(std::unique_ptr<int>(neam::cr::json_at<int>(data, "s")), "a string isn't an int");
+      fail_if(std::unique_ptr<int>(neam::cr::json_at<int>(data, "n", 41)), "n[41] isn't in the document");
+
+      // a malformed document
+      std::string malformed = "{\"a\": [1, 2, \"b\": 3}";
+      neam::cr::raw_data malformed_data(malformed.size(), reinterpret_cast<int8_t *>(&malformed[0]), neam::force_duplicate);
+      fail_if(neam::cr::json_find(malformed_data, value, value_size, "b"), "b is after an unclosed list");
+      malformed = "{\"a\": [1}, \"b\": 2}";
+      malformed_data = neam::cr::raw_data(malformed.size(), reinterpret_cast<int8_t *>(&malformed[0]), neam::force_duplicate);
+      fail_if(neam::cr::json_find(malformed_data, value, value_size, "b"), "b is after a list closed by a '}'");
+
+      // a negative index matches no member, whatever its name
+      std::string numbers = "{\"18446744073709551615\": 1, \"-1\": 2}";
+      neam::cr::raw_data numbers_data(numbers.size(), reinterpret_cast<int8_t *>(&numbers[0]), neam::force_duplicate);
+      fail_if(neam::cr::json_find(numbers_data, value, value_size, -1), "a negative index has been found");
+      fail_if(!neam::cr::json_find(numbers_data, value, value_size, "-1") || std::string(value, value_size) != "2", "the member \"-1\"");
+
+      // in serialized documents
+      std::map<std::string, std::vector<std::map<std::string, std::string>>> obj;
+      for (int k = 0; k < 100; ++k)
+        obj["key " + std::to_string(k)].resize(k % 4, std::map<std::string, std::string>({{std::to_string(k), "value " + std::to_string(k)}}));
+      for (bool compact : {false, true})
+      {
+        neam::cr::raw_data obj_data = (compact ? neam::cr::persistence::serialize<neam::cr::persistence_backend::json_compact>(obj)
+                                               : neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(obj));
+        for (int k = 0; k < 100; ++k)
+        {
+          str.reset(neam::cr::json_at<std::string>(obj_data, "key " + std::to_string(k), k % 4 - 1, k));
+          fail_if((k % 4 != 0) != !!str, "key " << k << ": wrong result");
+          fail_if(str && *str != "value " + std::to_string(k), "key " << k << ": results are differents");
+        }
+      }
+    }
+
+    /// \brief one element per line, the big documents are split in parts that are read in parallel
+    static void json_lines()
+    {
+      using element_t = std::map<std::string, std::vector<int>>;
+      for (size_t count : {0, 1, 10, 100000})
+      {
+        std::vector<element_t> list(count);
+        for (size_t i = 0; i < count; ++i)
+          list[i]["line \"" + std::to_string(i) + "\"\n"] = std::vector<int>(i % 5, static_cast<int>(i));
+
+        neam::cr::raw_data data = neam::cr::json_lines::serialize(list);
+        fail_if(count && !data.data, "unable to serialize " << count << " lines");
+        const std::string doc(reinterpret_cast<const char *>(data.data), data.size);
+        fail_if(static_cast<size_t>(std::count(doc.begin(), doc.end(), '\n')) != count, "there should be " << count << " lines");
+
+        std::vector<element_t> back(1); // (the elements are appended)
+        fail_if(!neam::cr::json_lines::deserialize(data, back), "unable to deserialize " << count << " lines");
+        fail_if(back.size() != count + 1 || !std::equal(list.begin(), list.end(), back.begin() + 1), count << " lines: results are differents");
+      }
+
+      // blank lines, "\r\n" line endings and no final line ending
+      const std::string doc = "[1]\r\n\n   \n[2, 3]\n\t\r\n[]\n[4]";
+      std::vector<std::vector<int>> back;
+      fail_if(!neam::cr::json_lines::deserialize(doc.data(), doc.size(), back), "unable to deserialize the handwritten lines");
+      fail_if(back != std::vector<std::vector<int>>({{1}, {2, 3}, {}, {4}}), "results are differents for the handwritten lines");
+    }
+
+    /// \brief a single malformed line makes the whole document fail, and the output is then left untouched
+    static void json_lines_malformed()
+    {
+      const char *malformed[] = {"[1]\n[2,]\n", "[1]\n[2 3]\n", "[1]\n[2]]x\n", "[1],[2]\n", "[1]\n\"a\"\n"};
+      for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i)
+      {
+        std::vector<std::vector<int>> back;
+        fail_if(neam::cr::json_lines::deserialize(malformed[i], strlen(malformed[i]), back), "the malformed document #" << i << " should not be deserialized");
+        fail_if(!back.empty(), "the output should be left untouched");
+      }
+
+      // in a big document (the malformed line is in one of the parts)
+      std::vector<std::vector<int>> list(200000, std::vector<int>({1, 2}));
+      neam::cr::raw_data data = neam::cr::json_lines::serialize(list);
+      std::string doc(reinterpret_cast<const char *>(data.data), data.size);
+      doc.insert(doc.size() / 2 - doc.size() / 2 % 6 + 4, ",");
+      std::vector<std::vector<int>> back(1);
+      fail_if(neam::cr::json_lines::deserialize(doc.data(), doc.size(), back), "a big document with a malformed line should not be deserialized");
+      fail_if(back.size() != 1, "the output should be left untouched");
+    }
+
+    /// \brief feed \e doc to \e reader, \e chunk_size bytes at a time
+    template<typename Element>
+    static bool feed(neam::cr::json_stream_reader<Element> &reader, const std::string &doc, size_t chunk_size)
+    {
+      for (size_t i = 0; i < doc.size(); i += chunk_size)
+      {
+        if (!reader.feed(doc.data() + i, std::min(chunk_size, doc.size() - i)))
+          return false;
+      }
+      return reader.end();
+    }
+
+    /// \brief the elements are read whatever the chunk boundaries they are split by
+    static void stream_reader(size_t chunk_size)
+    {
+      using element_t = std::map<std::string, std::vector<std::string>>;
+      std::vector<element_t> list(50);
+      for (size_t i = 0; i < list.size(); ++i)
+      {
+        for (size_t j = 0; j < i % 4; ++j)
+          list[i]["key \"" + std::to_string(j) + "\" {"] = std::vector<std::string>(j + 1, "]}\\\"," + std::to_string(i));
+      }
+
+      for (bool compact : {false, true})
+      {
+        neam::cr::raw_data data = (compact ? neam::cr::persistence::serialize<neam::cr::persistence_backend::json_compact>(list)
+                                           : neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(list));
+        const std::string doc(reinterpret_cast<const char *>(data.data), data.size); // (with the final '\0' of the serializer)
+
+        std::vector<element_t> back;
+        neam::cr::json_stream_reader<element_t> reader([&back](element_t &it) { back.push_back(std::move(it)); return true; });
+        fail_if(!feed(reader, doc, chunk_size), "unable to read the " << (compact ? "compact" : "pretty") << " document");
+        fail_if(reader.get_element_count() != list.size() || back != list, "results are differents");
+      }
+
+      // numbers end at the first character that isn't part of them, which may be in the next chunk
+      std::vector<int> numbers;
+      neam::cr::json_stream_reader<int> number_reader([&numbers](int &it) { numbers.push_back(it); return true; });
+      fail_if(!feed(number_reader, " [1,22 , 333,-4444,\n55555]\n", chunk_size), "unable to read the numbers");
+      fail_if(numbers != std::vector<int>({1, 22, 333, -4444, 55555}), "wrong numbers");
+
+      for (const char *it : {"[]", " [ ] ", "[\n]"})
+      {
+        neam::cr::json_stream_reader<int> empty_reader([](int &) { return false; });
+        fail_if(!feed(empty_reader, it, chunk_size) || empty_reader.get_element_count(), "'" << it << "' is an empty array");
+      }
+    }
+
+    /// \brief the malformed documents, an unfinished one, an element that is too big and a callback that stops the reading
+    static void stream_reader_malformed(size_t chunk_size)
+    {
+      for (const char *it : {"[1,2,]", "[1 2]", "[,1]", "[1,,2]", "{}", "1", "[1]x", "[1, 2", "[1, \"a\"]"})
+      {
+        neam::cr::json_stream_reader<int> int_reader([](int &) { return true; });
+        fail_if(feed(int_reader, it, chunk_size), "chunk size " << chunk_size << ": '" << it << "' should not be read");
+      }
+      for (const char *it : {"[[1,2,]]", "[[1], [2]", "[[1], [2}]"})
+      {
+        neam::cr::json_stream_reader<std::vector<int>> list_reader([](std::vector<int> &) { return true; });
+        fail_if(feed(list_reader, it, chunk_size), "chunk size " << chunk_size << ": '" << it << "' should not be read");
+      }
+      neam::cr::json_stream_reader<std::string> string_reader([](std::string &) { return true; });
+      fail_if(feed(string_reader, "[\"a\\x\"]", chunk_size), "chunk size " << chunk_size << ": a malformed escape sequence should not be read");
+
+      // the callback stops the reading
+      size_t count = 0;
+      neam::cr::json_stream_reader<int> reader([&count](int &) { return ++count < 2; });
+      fail_if(feed(reader, "[1, 2, 3]", chunk_size), "the callback should have stopped the reading");
+      fail_if(!reader.has_failed() || count != 2, "the reading should have stopped at the second element");
+
+      // the size of a single element is bounded
+      neam::cr::json_stream_reader<std::string> bounded_reader([](std::string &) { return true; }, 16);
+      fail_if(!feed(bounded_reader, "[\"small\", \"" + std::string(8, 'x') + "\"]", chunk_size), "the elements are small enough");
+      neam::cr::json_stream_reader<std::string> too_big_reader([](std::string &) { return true; }, 16);
+      fail_if(feed(too_big_reader, "[\"small\", \"" + std::string(100, 'x') + "\"]", chunk_size), "the second element is too big");
+    }
+
+    template<typename Type>
+    static bool read_number(const std::string &number, Type &value)
+    {
+      return neam::cr::internal::json::number_from_string(number.data(), number.size(), value);
+    }
+
+    /// \brief the limits of the integer types are read, the numbers that don't fit are rejected
+    static void integer_limits()
+    {
+      int64_t i64 = 0;
+      fail_if(!read_number("-9223372036854775808", i64) || i64 != std::numeric_limits<int64_t>::min(), "INT64_MIN");
+      fail_if(!read_number("9223372036854775807", i64) || i64 != std::numeric_limits<int64_t>::max(), "INT64_MAX");
+      fail_if(read_number("9223372036854775808", i64), "INT64_MAX + 1 should not fit");
+      fail_if(read_number("-9223372036854775809", i64), "INT64_MIN - 1 should not fit");
+
+      uint64_t u64 = 0;
+      fail_if(!read_number("18446744073709551615", u64) || u64 != std::numeric_limits<uint64_t>::max(), "UINT64_MAX");
+      fail_if(read_number("18446744073709551616", u64), "UINT64_MAX + 1 should not fit");
+      fail_if(read_number("100000000000000000000", u64), "1e20 should not fit");
+      fail_if(read_number("-1", u64), "-1 should not fit in an unsigned integer");
+
+      unsigned u = 0;
+      fail_if(read_number("-1", u), "-1 should not fit in an unsigned integer");
+      fail_if(read_number("-0", u), "-0 should not fit in an unsigned integer");
+      fail_if(!read_number("4294967295", u) || u != std::numeric_limits<unsigned>::max(), "UINT_MAX");
+      fail_if(read_number("4294967296", u), "UINT_MAX + 1 should not fit");
+
+      int8_t i8 = 0;
+      fail_if(!read_number("-128", i8) || i8 != -128, "INT8_MIN");
+      fail_if(!read_number("127", i8) || i8 != 127, "INT8_MAX");
+      fail_if(read_number("128", i8), "128 should not fit in an int8_t");
+      fail_if(read_number("-129", i8), "-129 should not fit in an int8_t");
+
+      uint8_t u8 = 0;
+      fail_if(!read_number("255", u8) || u8 != 255, "UINT8_MAX");
+      fail_if(read_number("256", u8), "256 should not fit in an uint8_t");
+      int16_t i16 = 0;
+      fail_if(read_number("32768", i16), "32768 should not fit in an int16_t");
+      fail_if(!read_number("-32768", i16) || i16 != -32768, "INT16_MIN");
+
+      // through the deserializer
+      neam::cr::raw_data data = neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(std::numeric_limits<int64_t>::min());
+      std::unique_ptr<int64_t> back(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, int64_t>(data));
+      fail_if(!back || *back != std::numeric_limits<int64_t>::min(), "INT64_MIN round trip");
+      std::string doc = "[1, -1]";
+      neam::cr::raw_data list_data(doc.size(), reinterpret_cast<int8_t *>(&doc[0]), neam::force_duplicate);
+      fail_if(std::unique_ptr<std::vector<unsigned>>(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::vector<unsigned>>(list_data)), "-1 should not be deserialized as an unsigned integer");
+    }
+
+    /// \brief floating point numbers with more digits than any buffer
+    static void long_floats()
+    {
+      double d = 0;
+      const std::string big = "1" + std::string(199, '0');
+      fail_if(!read_number(big, d) || d != 1e199, "a 200 digits integer part");
+      fail_if(!read_number(big + ".5e-100", d) || d != 1e99, "a 200 digits mantissa with an exponent");
+      fail_if(!read_number("-" + big, d) || d != -1e199, "a negative 200 digits number");
+      fail_if(!read_number("0." + std::string(198, '0') + "1", d) || d != 1e-199, "a 200 digits fractional part");
+      fail_if(!read_number(std::string(200, '3') + "e-200", d) || std::abs(d - 1. / 3.) > 1e-15, "200 digits of 3");
+      fail_if(read_number(big + std::string(200, '0'), d), "1e399 should not fit in a double");
+
+      // the digits that follow the number (in the document) are not read
+      const std::string doc = big + "123";
+      fail_if(!neam::cr::internal::json::number_from_string(doc.data(), big.size(), d) || d != 1e199, "the number should end at its size");
+
+      float f = 0;
+      fail_if(!read_number(big.substr(0, 30), f) || f != 1e29f, "a 30 digits float");
+      fail_if(read_number(big, f), "1e199 should not fit in a float");
+
+      std::string list = "[" + big + ", " + big + "]";
+      neam::cr::raw_data list_data(list.size(), reinterpret_cast<int8_t *>(&list[0]), neam::force_duplicate);
+      std::unique_ptr<std::vector<double>> back(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::vector<double>>(list_data));
+      fail_if(!back || back->size() != 2 || (*back)[0] != 1e199 || (*back)[1] != 1e199, "a list of 200 digits numbers");
+    }
+
+    /// \brief an exponent must have digits
+    static void exponents()
+    {
+      double d = 0;
+      const char *malformed[] = {"1e", "1E", "1e+", "1e-", "-2e", "1.5E+"};
+      for (const char *it : malformed)
+        fail_if(read_number(it, d), "'" << it << "' should not be read");
+      fail_if(!read_number("1e2", d) || d != 100, "1e2");
+      fail_if(!read_number("1.5E+1", d) || d != 15, "1.5E+1");
+      fail_if(!read_number("25e-1", d) || d != 2.5, "25e-1");
+      float f = 0;
+      fail_if(read_number("3e", f), "'3e' should not be read as a float");
+      fail_if((read_document<std::vector<double>>("[1e, 2]")), "a list with '1e' should not be deserialized");
+    }
+
+    /// \brief the output is still JSON (and is read back) when the C locale writes numbers with a decimal comma
+    static void comma_locale()
+    {
+      const char *locales[] = {"de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR"};
+      const char *locale = nullptr;
+      for (const char *it : locales)
+      {
+        if (setlocale(LC_NUMERIC, it))
+        {
+          locale = it;
+          break;
+        }
+      }
+
+      // (without any of them, the numbers are only checked in the C locale)
+      const double values[] = {1.5, -0.25, 1. / 3., 6.02214076e23, 1e-300, 123456.789};
+      bool success = true;
+      for (double value : values)
+      {
+        neam::cr::raw_data data = neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(value);
+        const std::string str = (data.data ? std::string(reinterpret_cast<const char *>(data.data), data.size - 1) : std::string());
+        std::unique_ptr<double> back(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, double>(data));
+        if (str.empty() || str.find(',') != std::string::npos || !back || *back != value)
+        {
+          std::cerr << "locale " << (locale ? locale : "C") << ": " << value << " written as '" << str << "'" << std::endl;
+          success = false;
+        }
+      }
+      std::vector<float> list = {0.5f, 1.f / 3.f, 2.75f};
+      neam::cr::raw_data data = neam::cr::persistence::serialize<neam::cr::persistence_backend::json_compact>(list);
+      std::unique_ptr<std::vector<float>> back(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, std::vector<float>>(data));
+      success = success && back && *back == list;
+
+      setlocale(LC_NUMERIC, "C");
+      fail_if(!success, "the numbers should be written with a '.' and read back");
+    }
+
+    /// \brief big documents (that are indexed) are deserialized as the small ones
+    static void indexed_document()
+    {
+      std::map<std::string, std::vector<std::string>> obj;
+      for (size_t i = 0; i < 500; ++i)
+        obj["key \"" + std::to_string(i) + "\" [{"] = std::vector<std::string>(i % 7, "\\\"],}" + std::to_string(i));
+      obj["empty"];
+
+      neam::cr::raw_data data = neam::cr::persistence::serialize<neam::cr::persistence_backend::json>(obj);
+      fail_if(data.size < neam::cr::internal::json::structural_index::min_document_size, "the document should be indexed");
+      std::unique_ptr<decltype(obj)> back(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, decltype(obj)>(data));
+      fail_if(!back, "unable to deserialize the document");
+      fail_if(*back != obj, "results are differents");
+
+      // a list that isn't closed
+      data.size = data.size / 2;
+      back.reset(neam::cr::persistence::deserialize<neam::cr::persistence_backend::json, decltype(obj)>(data));
+      fail_if(back, "a truncated document should not be deserialized");
+    }
+};
+
 int main()
 {
   stl_basic_test<neam::cr::persistence_backend::neam>::run();
 
   stl_basic_test<neam::cr::persistence_backend::json>::run();
+  stl_basic_test<neam::cr::persistence_backend::json_compact>::run();
+
+  wrapper_test<neam::cr::persistence_backend::neam>::run();
+  wrapper_test<neam::cr::persistence_backend::json>::run();
+  wrapper_test<neam::cr::persistence_backend::json_compact>::run();
+
+  parallel_test::run();
+  storage_test::run();
+  snapshot_test::run();
+  json_test::run();
 }